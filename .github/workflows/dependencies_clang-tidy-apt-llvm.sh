@@ -19,4 +19,4 @@ sudo add-apt-repository "deb http://apt.llvm.org/${UBUNTU_CODENAME}/ llvm-toolch
 sudo apt-get update
 
 sudo apt-get install -y --no-install-recommends \
-    clang-tidy-$1 libomp-$1-dev
+    clang-tidy-$1 libomp-$1-dev libfftw3-dev
@@ -0,0 +1,369 @@
+#include <cmath>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+
+#include <AMReX.H>
+#include <AMReX_Array.H>
+#include <AMReX_MultiFabUtil.H>
+#include <AMReX_ParallelDescriptor.H>
+#include <AMReX_Print.H>
+#include <AMReX_Vector.H>
+
+#include <extern_parameters.H>
+
+#include <network.H>
+#include <eos.H>
+
+#include <amrex_astro_util.H>
+#include <burn_rates.H>
+#include <diag_plotfile.H>
+#include <plotfile_catalog.H>
+#include <plotfile_writer.H>
+#include <profile_stats.H>
+
+using namespace amrex;
+
+///
+/// the zone with the largest |enuc| seen so far
+///
+struct EnucMax
+{
+    Real enuc{std::numeric_limits<Real>::lowest()};
+    int level{-1};
+    Array<Real, AMREX_SPACEDIM> pos{};
+    Real rho{0.0_rt};
+    Real T{0.0_rt};
+};
+
+void burn_rates_plotfile (const std::string& pltfile, PlotfileWriter& writer)
+{
+
+    std::string outfile = "burn_rates." +
+        std::filesystem::path(pltfile).filename().string();
+
+    DiagPlotFile pf(pltfile, diag_rp::max_level, diag_rp::coarsen);
+
+    const int ndims = pf.spaceDim();
+    AMREX_ALWAYS_ASSERT(ndims <= AMREX_SPACEDIM);
+
+    const int nlevs = pf.finestLevel() + 1;
+    const int coord = pf.coordSys();
+    const bool spherical = diag_rp::spherical;
+
+    // we need rho, T, and X
+
+    const Vector<std::string>& var_names_pf = pf.varNames();
+
+    const int dens_comp = get_dens_index(var_names_pf);
+    const int temp_comp = get_temp_index(var_names_pf);
+    const int spec_comp = get_spec_index(var_names_pf);
+
+    // the energy generation rate and the rate of change of each mass
+    // fraction
+
+    Vector<std::string> gvarnames;
+    gvarnames.emplace_back("enuc");
+    for (int n = 0; n < NumSpec; ++n) {
+        gvarnames.push_back("omegadot(" + short_spec_names_cxx[n] + ")");
+    }
+    const int ncomp = static_cast<int>(gvarnames.size());
+
+    auto const probLo = pf.probLo();
+    auto const probHi = pf.probHi();
+
+    Vector<Real> center(AMREX_SPACEDIM, 0.0_rt);
+    for (int idim = 0; idim < ndims; ++idim) {
+        center[idim] = 0.5_rt * (probLo[idim] + probHi[idim]);
+    }
+    if (coord == 1) {
+        // axisymmetric -- the center is on the axis
+        center[0] = probLo[0];
+    }
+
+    Array<int,AMREX_SPACEDIM> is_periodic{AMREX_D_DECL(0,0,0)};
+    for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+        is_periodic[idim] = 1;
+    }
+
+    Vector<Geometry> geom;
+    Vector<BoxArray> grids;
+    Vector<int> level_steps;
+    Vector<IntVect> ref_ratio;
+    for (int ilev = 0; ilev < nlevs; ++ilev) {
+        geom.emplace_back(pf.probDomain(ilev), RealBox(pf.probLo(),pf.probHi()),
+                          coord, is_periodic);
+        grids.push_back(pf.boxArray(ilev));
+        level_steps.push_back(pf.levelStep(ilev));
+        if (ilev < pf.finestLevel()) {
+            ref_ratio.push_back(IntVect(pf.refRatio(ilev)));
+            for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+                ref_ratio[ilev][idim] = 1;
+            }
+        }
+    }
+
+    // the profiles are binned in the vertical direction (plane-parallel)
+    // or in radius (spherical), with the finest zone width
+
+    const int vdir = ndims - 1;
+    auto const dx_fine = pf.cellSize(nlevs-1);
+    Real prof_r0{0.0_rt};
+    Real prof_dr{dx_fine[vdir]};
+    Real prof_rmax{0.0_rt};
+    if (spherical) {
+        for (int idim = 0; idim < ndims; ++idim) {
+            prof_dr = amrex::min(prof_dr, dx_fine[idim]);
+            Real d = amrex::max(probHi[idim] - center[idim], center[idim] - probLo[idim]);
+            prof_rmax += d * d;
+        }
+        prof_rmax = std::sqrt(prof_rmax);
+    } else {
+        prof_r0 = probLo[vdir];
+        prof_rmax = probHi[vdir] - probLo[vdir];
+    }
+    const int prof_nbins = static_cast<int>(std::ceil(prof_rmax / prof_dr)) + 1;
+
+    StratifiedProfile profile(prof_nbins, prof_r0, prof_dr, ncomp);
+
+    EnucMax enuc_max;
+    Real enuc_total{0.0_rt};
+
+    Vector<MultiFab> gmf(nlevs);
+
+    for (int ilev = 0; ilev < nlevs; ++ilev) {
+
+        MultiFab lev_data_mf = pf.get(ilev);
+
+        // only the zones not covered by a finer level are evaluated --
+        // the covered ones are filled by averaging down below
+
+        iMultiFab mask(pf.boxArray(ilev), pf.DistributionMap(ilev), 1, 0);
+        if (ilev < nlevs-1) {
+            mask = makeFineMask(pf.boxArray(ilev), pf.DistributionMap(ilev),
+                                pf.boxArray(ilev+1), ref_ratio[ilev]);
+        } else {
+            mask.setVal(0);
+        }
+
+        gmf[ilev].define(pf.boxArray(ilev), pf.DistributionMap(ilev), ncomp, 0);
+        gmf[ilev].setVal(0.0_rt);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel
+#endif
+        for (MFIter mfi(gmf[ilev], TilingIfNotGPU()); mfi.isValid(); ++mfi) {
+            const Box& bx = mfi.tilebox();
+            auto const& ga = gmf[ilev].array(mfi);
+            auto const& fab = lev_data_mf.const_array(mfi);
+            auto const& m = mask.const_array(mfi);
+
+            amrex::ParallelFor(bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+            {
+                if (m(i,j,k) == 1) {
+                    return;
+                }
+
+                Real X[NumSpec];
+                Real dXdt[NumSpec];
+                for (int n = 0; n < NumSpec; ++n) {
+                    X[n] = fab(i,j,k,spec_comp+n);
+                }
+
+                ga(i,j,k,0) = burn_rates(fab(i,j,k,dens_comp), fab(i,j,k,temp_comp), X, dXdt);
+                for (int n = 0; n < NumSpec; ++n) {
+                    ga(i,j,k,1+n) = dXdt[n];
+                }
+            });
+        }
+
+        // the reductions over the uncovered zones: the largest |enuc|,
+        // the total energy generation rate, and the profiles.  These run
+        // on the host, so GPU builds copy the rates, rho and T, and the
+        // mask to pinned memory first.
+
+#ifdef AMREX_USE_GPU
+        MultiFab rates(gmf[ilev].boxArray(), gmf[ilev].DistributionMap(), ncomp, 0,
+                       MFInfo().SetArena(The_Pinned_Arena()));
+        MultiFab::Copy(rates, gmf[ilev], 0, 0, ncomp, 0);
+
+        MultiFab state(lev_data_mf.boxArray(), lev_data_mf.DistributionMap(), lev_data_mf.nComp(), 0,
+                       MFInfo().SetArena(The_Pinned_Arena()));
+        MultiFab::Copy(state, lev_data_mf, dens_comp, dens_comp, 1, 0);
+        MultiFab::Copy(state, lev_data_mf, temp_comp, temp_comp, 1, 0);
+
+        iMultiFab host_mask(mask.boxArray(), mask.DistributionMap(), 1, 0,
+                            MFInfo().SetArena(The_Pinned_Arena()));
+        iMultiFab::Copy(host_mask, mask, 0, 0, 1, 0);
+#else
+        const MultiFab& rates = gmf[ilev];
+        const MultiFab& state = lev_data_mf;
+        const iMultiFab& host_mask = mask;
+#endif
+
+        Gpu::streamSynchronize();
+
+        auto const dx = pf.cellSize(ilev);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel
+#endif
+        {
+            EnucMax local_max;
+            Real local_total{0.0_rt};
+
+            for (MFIter mfi(rates, TilingIfNotGPU()); mfi.isValid(); ++mfi) {
+                const Box& bx = mfi.tilebox();
+                auto const& ga = rates.const_array(mfi);
+                auto const& fab = state.const_array(mfi);
+                auto const& m = host_mask.const_array(mfi);
+                const auto lo = amrex::lbound(bx);
+                const auto hi = amrex::ubound(bx);
+
+                std::map<int, Stratum> strata;
+
+                for (int k = lo.z; k <= hi.z; ++k) {
+                    for (int j = lo.y; j <= hi.y; ++j) {
+                        for (int i = lo.x; i <= hi.x; ++i) {
+                            if (m(i,j,k) == 1) {
+                                continue;
+                            }
+
+                            Array<Real, AMREX_SPACEDIM> p = {AMREX_D_DECL(probLo[0] + (static_cast<Real>(i) + 0.5_rt) * dx[0],
+                                                                          probLo[1] + (static_cast<Real>(j) + 0.5_rt) * dx[1],
+                                                                          probLo[2] + (static_cast<Real>(k) + 0.5_rt) * dx[2])};
+
+                            auto [r_zone, vol] = zone_radius_volume(p, center, dx, coord, ndims, spherical);
+
+                            const Real enuc = ga(i,j,k,0);
+                            local_total += fab(i,j,k,dens_comp) * enuc * vol;
+
+                            if (std::abs(enuc) > local_max.enuc) {
+                                local_max.enuc = std::abs(enuc);
+                                local_max.level = ilev;
+                                local_max.pos = p;
+                                local_max.rho = fab(i,j,k,dens_comp);
+                                local_max.T = fab(i,j,k,temp_comp);
+                            }
+
+                            if (diag_rp::profile) {
+                                const Real r = spherical ? r_zone : p[vdir];
+                                auto& s = strata.try_emplace(profile.bin(r), ncomp).first->second;
+                                s.vol += vol;
+                                s.nzones += 1;
+                                s.nsamples += 1;
+                                for (int c = 0; c < ncomp; ++c) {
+                                    s.sum[c] += ga(i,j,k,c);
+                                    s.sum2[c] += ga(i,j,k,c) * ga(i,j,k,c);
+                                }
+                            }
+                        }
+                    }
+                }
+
+                if (diag_rp::profile) {
+                    profile.add(strata);
+                }
+            }
+
+#ifdef AMREX_USE_OMP
+#pragma omp critical (burn_rates_reduce)
+#endif
+            {
+                enuc_total += local_total;
+                if (local_max.enuc > enuc_max.enuc) {
+                    enuc_max = local_max;
+                }
+            }
+        }
+
+        pf.release(std::move(lev_data_mf));
+    }
+
+    // fill the covered zones from the finer levels
+
+    for (int ilev = nlevs-1; ilev > 0; --ilev) {
+        amrex::average_down(gmf[ilev], gmf[ilev-1], geom[ilev], geom[ilev-1],
+                            0, ncomp, ref_ratio[ilev-1]);
+    }
+
+    writer.setAugmentTarget(pltfile, "burn_rates");
+    writer.begin(outfile, grids, gvarnames, geom, pf.time(), level_steps, ref_ratio);
+    for (int ilev = 0; ilev < nlevs; ++ilev) {
+        writer.write_level(ilev, std::move(gmf[ilev]));
+    }
+
+    // the largest |enuc| over all ranks -- the zone comes from the
+    // lowest rank that has it
+
+    const int nprocs = ParallelDescriptor::NProcs();
+    const int myproc = ParallelDescriptor::MyProc();
+
+    Real global_max = enuc_max.enuc;
+    ParallelDescriptor::ReduceRealMax(global_max);
+    int owner = (enuc_max.enuc == global_max) ? myproc : nprocs;
+    ParallelDescriptor::ReduceIntMin(owner);
+
+    Vector<Real> zone{static_cast<Real>(enuc_max.level), enuc_max.rho, enuc_max.T};
+    for (int idim = 0; idim < AMREX_SPACEDIM; ++idim) {
+        zone.push_back(enuc_max.pos[idim]);
+    }
+    ParallelDescriptor::Bcast(zone.data(), zone.size(), owner);
+
+    ParallelDescriptor::ReduceRealSum(enuc_total);
+
+    amrex::Print() << "enuc_max = " << global_max
+                   << " on level " << static_cast<int>(zone[0]) << " at (";
+    for (int idim = 0; idim < ndims; ++idim) {
+        amrex::Print() << (idim > 0 ? ", " : "") << zone[3+idim];
+    }
+    amrex::Print() << "), rho = " << zone[1] << ", T = " << zone[2] << "\n"
+                   << "total energy generation rate = " << enuc_total << " erg/s" << std::endl;
+
+    if (diag_rp::profile) {
+        profile.reduce();
+        std::string profile_file = "burn_rates_profile." +
+            std::filesystem::path(pltfile).filename().string();
+        profile.write(profile_file, gvarnames);
+    }
+}
+
+void main_main()
+{
+
+    auto pltfiles = select_plotfiles(diag_rp::plotfile, diag_rp::catalog, diag_rp::query);
+
+    // one writer is shared by all of the plotfiles, so the output of one
+    // plotfile goes to disk while the next one is processed
+
+    PlotfileWriter writer(diag_rp::async_output);
+    writer.setFormat(diag_rp::output_format, diag_rp::float_fields, diag_rp::hdf5_compression);
+
+    for (auto const& pltfile : pltfiles) {
+        amrex::Print() << "processing " << pltfile << std::endl;
+        burn_rates_plotfile(pltfile, writer);
+    }
+
+    writer.wait();
+}
+
+int main (int argc, char* argv[])
+{
+    amrex::SetVerbose(0);
+    amrex::Initialize(argc, argv, true, MPI_COMM_WORLD, enable_async_output);
+
+    // initialize the runtime parameters
+
+    init_extern_parameters();
+
+    // initialize C++ Microphysics
+
+    eos_init(diag_rp::small_temp, diag_rp::small_dens);
+    network_init();
+
+    main_main();
+    amrex::Finalize();
+}
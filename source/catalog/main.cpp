@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <AMReX.H>
+#include <AMReX_ParallelDescriptor.H>
+#include <AMReX_Print.H>
+#include <AMReX_Vector.H>
+
+#include <extern_parameters.H>
+
+#include <plotfile_catalog.H>
+
+using namespace amrex;
+
+void main_main()
+{
+
+    namespace fs = std::filesystem;
+
+    fs::path run_dir(diag_rp::run_dir);
+    if (!fs::is_directory(run_dir)) {
+        amrex::Error("catalog: " + diag_rp::run_dir + " is not a directory");
+    }
+
+    const std::string prefix(diag_rp::prefix);
+
+    Vector<std::string> job_info_keys;
+    {
+        std::istringstream iss(diag_rp::job_info_keys);
+        std::string key;
+        while (iss >> key) {
+            job_info_keys.push_back(key);
+        }
+    }
+
+    // the plotfiles are the directories with the right prefix that have
+    // a Header.  Old plotfiles that AMReX renamed (plt00100.old.xxx) are
+    // skipped.
+
+    Vector<std::string> names;
+    for (auto const& entry : fs::directory_iterator(run_dir)) {
+        std::string name = entry.path().filename().string();
+        if (entry.is_directory() &&
+            name.compare(0, prefix.size(), prefix) == 0 &&
+            name.find(".old") == std::string::npos &&
+            fs::exists(entry.path() / "Header")) {
+            names.push_back(name);
+        }
+    }
+
+    // sort by name, with shorter names first so plt9999 comes before
+    // plt10000
+
+    std::sort(names.begin(), names.end(),
+              [] (const std::string& a, const std::string& b)
+              {
+                  return (a.size() != b.size()) ? a.size() < b.size() : a < b;
+              });
+
+    const auto nplt = static_cast<int>(names.size());
+    amrex::Print() << "cataloging " << nplt << " plotfiles in " << diag_rp::run_dir << std::endl;
+
+    // each rank takes a contiguous block of plotfiles, so the blocks
+    // gathered in rank order stay sorted, and the threads of a rank
+    // share its block
+
+    const int nprocs = ParallelDescriptor::NProcs();
+    const int myproc = ParallelDescriptor::MyProc();
+    const int ibegin = static_cast<int>((static_cast<Long>(nplt) * myproc) / nprocs);
+    const int iend = static_cast<int>((static_cast<Long>(nplt) * (myproc+1)) / nprocs);
+
+    Vector<std::string> text(iend - ibegin);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int i = ibegin; i < iend; ++i) {
+        auto e = make_catalog_entry((run_dir / names[i]).string(), names[i], job_info_keys);
+        std::ostringstream os;
+        write_catalog_entry(os, e);
+        text[i - ibegin] = os.str();
+    }
+
+    std::string local;
+    for (auto const& t : text) {
+        local += t;
+    }
+
+    // gather everything onto the I/O processor
+
+    const int ioproc = ParallelDescriptor::IOProcessorNumber();
+
+    int nlocal = static_cast<int>(local.size());
+    Vector<int> counts(nprocs, 0);
+    ParallelDescriptor::Gather(&nlocal, 1, counts.data(), ioproc);
+
+    std::vector<int> recvcnts(counts.begin(), counts.end());
+    std::vector<int> disp(nprocs, 0);
+    for (int n = 1; n < nprocs; ++n) {
+        disp[n] = disp[n-1] + recvcnts[n-1];
+    }
+
+    std::string all;
+    if (ParallelDescriptor::IOProcessor()) {
+        all.resize(static_cast<std::size_t>(disp[nprocs-1] + recvcnts[nprocs-1]));
+    }
+    ParallelDescriptor::Gatherv(local.data(), nlocal, all.data(), recvcnts, disp, ioproc);
+
+    if (ParallelDescriptor::IOProcessor()) {
+        std::ofstream of(diag_rp::catalog);
+        if (!of.good()) {
+            amrex::FileOpenFailed(diag_rp::catalog);
+        }
+        of << "# amrex-astro-diag plotfile catalog\n";
+        of << "root " << fs::absolute(run_dir).lexically_normal().string() << "\n";
+        of << all;
+    }
+
+    amrex::Print() << "wrote " << diag_rp::catalog << std::endl;
+}
+
+int main (int argc, char* argv[])
+{
+    amrex::SetVerbose(0);
+    amrex::Initialize(argc, argv);
+
+    // initialize the runtime parameters
+
+    init_extern_parameters();
+
+    main_main();
+    amrex::Finalize();
+}
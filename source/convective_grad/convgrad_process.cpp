@@ -0,0 +1,614 @@
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <AMReX.H>
+#include <AMReX_Array.H>
+#include <AMReX_FillPatchUtil.H>
+#include <AMReX_MultiFabUtil.H>
+#include <AMReX_Print.H>
+#include <AMReX_PlotFileUtil.H>
+#include <AMReX_Vector.H>
+
+#include <extern_parameters.H>
+
+#include <network.H>
+#include <eos.H>
+
+#include <amrex_astro_util.H>
+#include <diag_plotfile.H>
+#include <plotfile_writer.H>
+#include <slice_extract.H>
+
+#include <convective_boundary.H>
+#include <convective_grad.H>
+#include <convgrad_process.H>
+#include <profile_stats.H>
+#include <task_scheduler.H>
+
+using namespace amrex;
+
+///
+/// evaluate the gradients on one tile.  This is a named function rather
+/// than a lambda so that it can launch a GPU kernel from inside a task.
+///
+void convgrad_tile (const Box& bx, int ilev, int ndims, bool spherical,
+                    Array4<Real> const& ga,
+                    Array4<Real const> const& T,
+                    Array4<Real const> const& P,
+                    Array4<Real const> const& X,
+                    Array4<Real const> const& fab,
+                    Array4<int const> const& m,
+                    int dens_comp, int temp_comp,
+                    Array<Real, AMREX_SPACEDIM> const& probLo,
+                    Array<Real, AMREX_SPACEDIM> const& dx,
+                    Array<Real, AMREX_SPACEDIM> const& center,
+                    bool sampling, Real sample_fraction, int sample_seed)
+{
+    amrex::ParallelFor(bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+    {
+        Real del{0.0};
+        Real del_ad{0.0};
+        Real del_ledoux{0.0};
+
+        if (sampling &&
+            (m(i,j,k) == 1 || sample_uniform(ilev, i, j, k, sample_seed) >= sample_fraction)) {
+            ga(i,j,k,0) = del;
+            ga(i,j,k,1) = del_ad;
+            ga(i,j,k,2) = del_ledoux;
+            return;
+        }
+
+        convective_gradients(i, j, k, ndims, spherical,
+                             T, P, X, fab, dens_comp, temp_comp,
+                             probLo, dx, center,
+                             del, del_ad, del_ledoux);
+
+        ga(i,j,k,0) = del;
+        ga(i,j,k,1) = del_ad;
+        ga(i,j,k,2) = del_ledoux;
+
+    });
+}
+
+void convective_grad_plotfile (const std::string& pltfile, PlotfileWriter& writer,
+                               MultiFabPool& pool)
+{
+
+    std::string outfile = "convgrad." +
+        std::filesystem::path(pltfile).filename().string();
+
+
+    DiagPlotFile pf(pltfile, diag_rp::max_level, diag_rp::coarsen);
+    if (diag_rp::use_pool) {
+        pf.setPool(&pool);
+    }
+
+    const int ndims = pf.spaceDim();
+    AMREX_ALWAYS_ASSERT(ndims <= AMREX_SPACEDIM);
+
+    // in slice mode only the grids near the slice are read, and the
+    // gradients are only evaluated on the slice
+
+    std::unique_ptr<SliceExtractor> slice;
+    if (!diag_rp::slice.empty()) {
+        slice = std::make_unique<SliceExtractor>(pf, diag_rp::slice);
+        pf.restrict_to(slice->box(), 2);
+    }
+
+    const int nlevs = pf.finestLevel() + 1;
+
+    Vector<std::string> varnames;
+    varnames = pf.varNames();
+
+    // find variable indices -- we want density, temperature, and species.
+    // we will assume here that the species are contiguous, so we will find
+    // the index of the first species
+
+    // the plotfile can store either (rho X) or just X alone.  Here we'll assume
+    // that we have just X alone
+
+    const Vector<std::string>& var_names_pf = pf.varNames();
+
+    int dens_comp = get_dens_index(var_names_pf);
+    int temp_comp = get_temp_index(var_names_pf);
+    int pres_comp = get_pres_index(var_names_pf);
+    int spec_comp = get_spec_index(var_names_pf);
+    // create the variable names we will derive and store in the output
+    // file
+
+    Vector<std::string> gvarnames;
+    gvarnames.push_back("del");
+    gvarnames.push_back("del_ad");
+    gvarnames.push_back("del_ledoux");
+
+    // interpret the boundary conditions
+
+    BCRec bcr_default;
+    Array<int,AMREX_SPACEDIM> is_periodic{AMREX_D_DECL(0,0,0)};
+    IntVect ng(1);
+    for (int idim = 0; idim < AMREX_SPACEDIM; ++idim) {
+        if (idim < ndims) {
+            bcr_default.setLo(idim, BCType::hoextrapcc);
+            bcr_default.setHi(idim, BCType::hoextrapcc);
+        } else {
+            bcr_default.setLo(idim, BCType::int_dir);
+            bcr_default.setHi(idim, BCType::int_dir);
+            is_periodic[idim] = 1;
+            ng[idim] = 0;
+        }
+    }
+
+    // get center if spherical
+
+    Array<Real, AMREX_SPACEDIM> center{};
+    auto const probLo = pf.probLo();
+    auto const probHi = pf.probHi();
+
+    if (diag_rp::spherical){
+        for (int idim = 0; idim < AMREX_SPACEDIM; ++idim){
+            center[idim] = 0.5_rt * (probHi[idim] - probLo[idim]);
+        }
+    }
+
+    // the output only depends on the grids, so we can start the plotfile
+    // now and hand each level to the writer as soon as it is done
+
+    Vector<Geometry> geom;
+    Vector<BoxArray> grids;
+    Vector<int> level_steps;
+    Vector<IntVect> ref_ratio;
+    for (int ilev = 0; ilev < nlevs; ++ilev) {
+        geom.emplace_back(pf.probDomain(ilev), RealBox(pf.probLo(),pf.probHi()),
+                          pf.coordSys(), is_periodic);
+        grids.push_back(pf.boxArray(ilev));
+        level_steps.push_back(pf.levelStep(ilev));
+        if (ilev < pf.finestLevel()) {
+            ref_ratio.push_back(IntVect(pf.refRatio(ilev)));
+            for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+                ref_ratio[ilev][idim] = 1;
+            }
+        }
+    }
+
+    // in sampling mode we only evaluate a reproducible random subset of
+    // the zones not covered by a finer level, and only output the
+    // profiles.  Otherwise we evaluate every zone and write a plotfile,
+    // optionally also computing the (exact) profiles.
+
+    const Real sample_fraction = diag_rp::sample_fraction;
+    const int sample_seed = diag_rp::sample_seed;
+    const bool sampling = sample_fraction < 1.0_rt;
+    const bool do_profile = sampling || diag_rp::profile;
+
+    // in boundary mode we only output where the convective boundaries
+    // are along each column or ray, not the full fields
+
+    const bool do_boundaries = diag_rp::boundaries;
+    const bool write_plotfile = !sampling && !do_boundaries && !slice;
+
+    if (sampling && do_boundaries) {
+        amrex::Error("the boundaries need every zone, so they can't be found with sample_fraction < 1");
+    }
+    if (slice && (do_profile || do_boundaries)) {
+        amrex::Error("the profiles and boundaries need all of the data, so they can't be used with a slice");
+    }
+
+    // the profiles are binned in the vertical direction (plane-parallel)
+    // or in radius (spherical), with the finest zone width
+
+    const int vdir = ndims - 1;
+    auto const dx_fine = pf.cellSize(nlevs-1);
+    Real prof_r0{0.0_rt};
+    Real prof_dr{dx_fine[vdir]};
+    Real prof_rmax{0.0_rt};
+    if (diag_rp::spherical) {
+        for (int idim = 0; idim < ndims; ++idim) {
+            prof_dr = amrex::min(prof_dr, dx_fine[idim]);
+            Real d = amrex::max(probHi[idim] - center[idim], center[idim] - probLo[idim]);
+            prof_rmax += d * d;
+        }
+        prof_rmax = std::sqrt(prof_rmax);
+    } else {
+        prof_r0 = probLo[vdir];
+        prof_rmax = probHi[vdir] - probLo[vdir];
+    }
+    const int prof_nbins = static_cast<int>(std::ceil(prof_rmax / prof_dr)) + 1;
+
+    StratifiedProfile profile(prof_nbins, prof_r0, prof_dr,
+                              static_cast<int>(gvarnames.size()));
+
+    if (write_plotfile) {
+        writer.setAugmentTarget(pltfile, "convgrad");
+        writer.begin(outfile, grids, gvarnames, geom, pf.time(), level_steps, ref_ratio);
+    }
+
+    // the levels are filled in order on this thread, and as soon as a
+    // level is filled its tiles are handed to the task scheduler.  The
+    // workers evaluate them (stealing from each other to balance the
+    // uneven EOS cost) while we go on to fill the next level.  Once the
+    // next level is handed over, we wait for the tasks of the previous
+    // one, release its inputs and write it, so only about two levels of
+    // inputs are alive at a time.  The levels are finished in order on
+    // every rank, so the collective writes match up.
+
+    struct LevelData
+    {
+        MultiFab gmf;
+        MultiFab temp_mf;
+        MultiFab pres_mf;
+        MultiFab species_mf;
+        MultiFab lev_data_mf;
+        iMultiFab mask;
+#ifdef AMREX_USE_GPU
+        // pinned copies of the gradients and the mask for the profiles,
+        // which are accumulated on the host
+        MultiFab host_gmf;
+        iMultiFab host_mask;
+#endif
+        Array<Real, AMREX_SPACEDIM> dx{};
+        Vector<int> local_boxes;
+        std::atomic<int> tiles_left{0};
+        // the tile and profile tasks that haven't finished
+        std::atomic<int> tasks_left{0};
+    };
+
+    Vector<std::unique_ptr<LevelData>> levels;
+
+#ifdef AMREX_USE_GPU
+    // the kernels are launched from this thread
+    const int nthreads = 1;
+#else
+    const int nthreads = (diag_rp::nthreads > 0) ? diag_rp::nthreads : TaskScheduler::default_threads();
+#endif
+    TaskScheduler scheduler(nthreads);
+
+    const bool spherical = diag_rp::spherical;
+    const int coord = pf.coordSys();
+
+    // wait for the tasks of a level, then free its inputs and hand its
+    // output to the writer (the boundaries and slices need the output of
+    // every level, and keep it)
+
+    auto finish_level = [&] (int ilev)
+    {
+        LevelData& ld = *levels[ilev];
+        scheduler.wait_until([&ld] () { return ld.tasks_left.load() == 0; });
+        Gpu::streamSynchronize();
+
+        pool.release(std::move(ld.temp_mf));
+        pool.release(std::move(ld.pres_mf));
+        pool.release(std::move(ld.species_mf));
+        pool.release(std::move(ld.lev_data_mf));
+        ld.mask.clear();
+#ifdef AMREX_USE_GPU
+        ld.host_gmf.clear();
+        ld.host_mask.clear();
+#endif
+
+        if (write_plotfile) {
+            writer.write_level(ilev, std::move(ld.gmf));
+        }
+    };
+
+    // we need both T and P constructed with ghost cells
+
+    for (int ilev = 0; ilev < nlevs; ++ilev)
+    {
+
+        levels.push_back(std::make_unique<LevelData>());
+        LevelData& ld = *levels.back();
+
+        // output MultiFab
+
+        ld.gmf = pool.acquire(pf.boxArray(ilev), pf.DistributionMap(ilev), static_cast<int>(gvarnames.size()), 0);
+        if (pf.restricted()) {
+            ld.gmf.setVal(0.0_rt);
+        }
+
+        Vector<BCRec> bcr{bcr_default};
+        auto is_per = is_periodic;
+
+        const Geometry& vargeom = geom[ilev];
+
+        PhysBCFunct<GpuBndryFuncFab<FabFillNoOp>> physbcf
+            (vargeom, bcr, GpuBndryFuncFab<FabFillNoOp>(FabFillNoOp{}));
+
+        // fill the pressure and temperature mfs with ghost cells
+        // we also need all of the species.  These and the data read to
+        // fill them come from (and go back to) the pool.
+
+        MultiFab& temp_mf = ld.temp_mf;
+        MultiFab& pres_mf = ld.pres_mf;
+        MultiFab& species_mf = ld.species_mf;
+
+        temp_mf = pool.acquire(pf.boxArray(ilev), pf.DistributionMap(ilev), 1, ng);
+        pres_mf = pool.acquire(pf.boxArray(ilev), pf.DistributionMap(ilev), 1, ng);
+        species_mf = pool.acquire(pf.boxArray(ilev), pf.DistributionMap(ilev), NumSpec, ng);
+
+        // fill component dst_comp of dst from plotfile variable src_comp
+
+        std::function<void(MultiFab&, int, int)> fill;
+
+        if (ilev == 0) {
+
+            fill = [&] (MultiFab& dst, int src_comp, int dst_comp)
+            {
+                MultiFab smf = pf.get(ilev, var_names_pf[src_comp]);
+                FillPatchSingleLevel(dst, ng, Real(0.0), {&smf}, {Real(0.0)},
+                                     0, dst_comp, 1, vargeom, physbcf, 0);
+                pool.release(std::move(smf));
+            };
+
+        } else {
+
+            fill = [&] (MultiFab& dst, int src_comp, int dst_comp)
+            {
+                auto* mapper = (Interpolater*)(&cell_cons_interp);
+
+                IntVect ratio(pf.refRatio(ilev-1));
+                for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+                    ratio[idim] = 1;
+                }
+
+                Geometry cgeom(pf.probDomain(ilev-1), RealBox(pf.probLo(),pf.probHi()),
+                               pf.coordSys(), is_per);
+                PhysBCFunct<GpuBndryFuncFab<FabFillNoOp>> cphysbcf
+                    (cgeom, bcr, GpuBndryFuncFab<FabFillNoOp>(FabFillNoOp{}));
+
+                MultiFab cmf = pf.get(ilev-1, var_names_pf[src_comp]);
+                MultiFab fmf = pf.get(ilev  , var_names_pf[src_comp]);
+                FillPatchTwoLevels(dst, ng, Real(0.0), {&cmf}, {Real(0.0)},
+                                   {&fmf}, {Real(0.0)}, 0, dst_comp, 1, cgeom, vargeom,
+                                   cphysbcf, 0, physbcf, 0, ratio, mapper, bcr, 0);
+                pool.release(std::move(cmf));
+                pool.release(std::move(fmf));
+            };
+        }
+
+        fill(temp_mf, temp_comp, 0);
+        fill(pres_mf, pres_comp, 0);
+        for (int n = 0; n < NumSpec; ++n) {
+            fill(species_mf, spec_comp+n, n);
+        }
+
+        ld.dx = pf.cellSize(ilev);
+
+        ld.lev_data_mf = pf.get(ilev);
+
+        // mark the zones covered by the next finer level -- these don't
+        // contribute to the profiles
+
+        ld.mask.define(pf.boxArray(ilev), pf.DistributionMap(ilev), 1, 0);
+        if (do_profile && ilev < nlevs-1) {
+            IntVect ratio{pf.refRatio(ilev)};
+            for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+                ratio[idim] = 1;
+            }
+            ld.mask = makeFineMask(pf.boxArray(ilev), pf.DistributionMap(ilev),
+                                   pf.boxArray(ilev+1), ratio);
+        } else {
+            ld.mask.setVal(0);
+        }
+
+        // each box and profile bin is a stratum.  The strata are
+        // accumulated by box and then added to the bins.  This needs the
+        // whole box, so the last tile of the level submits these tasks.
+
+        auto profile_box = [&ld, &profile, ilev, ndims, vdir, coord, spherical,
+                            probLo, center, sampling, sample_fraction, sample_seed] (int index)
+        {
+            const Box& bx = ld.gmf.boxArray()[index];
+#ifdef AMREX_USE_GPU
+            const auto& ga = ld.host_gmf.const_array(index);
+            const auto& m = ld.host_mask.const_array(index);
+#else
+            const auto& ga = ld.gmf.const_array(index);
+            const auto& m = ld.mask.const_array(index);
+#endif
+            const auto& dx = ld.dx;
+            const auto lo = amrex::lbound(bx);
+            const auto hi = amrex::ubound(bx);
+
+            std::map<int, Stratum> strata;
+
+            for (int k = lo.z; k <= hi.z; ++k) {
+                for (int j = lo.y; j <= hi.y; ++j) {
+                    for (int i = lo.x; i <= hi.x; ++i) {
+                        if (m(i,j,k) == 1) {
+                            continue;
+                        }
+
+                        Array<Real, AMREX_SPACEDIM> p = {AMREX_D_DECL(probLo[0] + (static_cast<Real>(i) + 0.5_rt) * dx[0],
+                                                                      probLo[1] + (static_cast<Real>(j) + 0.5_rt) * dx[1],
+                                                                      probLo[2] + (static_cast<Real>(k) + 0.5_rt) * dx[2])};
+
+                        auto [r_zone, vol] = zone_radius_volume(p, center, dx, coord, ndims, spherical);
+                        const Real r = spherical ? r_zone : p[vdir];
+
+                        auto& s = strata.try_emplace(profile.bin(r), 3).first->second;
+                        s.vol += vol;
+                        s.nzones += 1;
+
+                        if (!sampling || sample_uniform(ilev, i, j, k, sample_seed) < sample_fraction) {
+                            s.nsamples += 1;
+                            for (int c = 0; c < 3; ++c) {
+                                s.sum[c] += ga(i,j,k,c);
+                                s.sum2[c] += ga(i,j,k,c) * ga(i,j,k,c);
+                            }
+                        }
+                    }
+                }
+            }
+
+            profile.add(strata);
+        };
+
+        // the tiles of this level only depend on its ghost cells, which
+        // are now filled.  In slice mode only the part of each tile in
+        // the slice is evaluated.
+
+        Vector<std::pair<int, Box>> tiles;
+        for (MFIter mfi(temp_mf, TilingIfNotGPU()); mfi.isValid(); ++mfi) {
+            const Box bx = mfi.tilebox() & pf.region(ilev);
+            if (bx.ok()) {
+                tiles.emplace_back(mfi.index(), bx);
+            }
+        }
+
+        // MFIter can't be used on the workers, so we note the boxes of
+        // this rank for the profile tasks here
+
+        for (MFIter mfi(ld.gmf); mfi.isValid(); ++mfi) {
+            ld.local_boxes.push_back(mfi.index());
+        }
+        ld.tiles_left = static_cast<int>(tiles.size());
+        ld.tasks_left = static_cast<int>(tiles.size());
+        if (do_profile && !tiles.empty()) {
+            ld.tasks_left += static_cast<int>(ld.local_boxes.size());
+        }
+
+        for (auto const& [index, bx] : tiles) {
+            scheduler.submit([&ld, &scheduler, profile_box, index, bx, ilev, ndims, spherical,
+                              dens_comp, temp_comp, probLo, center,
+                              do_profile, sampling, sample_fraction, sample_seed] ()
+            {
+                convgrad_tile(bx, ilev, ndims, spherical,
+                              ld.gmf.array(index),
+                              ld.temp_mf.const_array(index),
+                              ld.pres_mf.const_array(index),
+                              ld.species_mf.const_array(index),
+                              ld.lev_data_mf.const_array(index),
+                              ld.mask.const_array(index),
+                              dens_comp, temp_comp, probLo, ld.dx, center,
+                              sampling, sample_fraction, sample_seed);
+
+                if (--ld.tiles_left == 0 && do_profile) {
+#ifdef AMREX_USE_GPU
+                    // GPU builds have a single thread, so this runs
+                    // where the kernels were launched
+                    ld.host_gmf.define(ld.gmf.boxArray(), ld.gmf.DistributionMap(), 3, 0,
+                                       MFInfo().SetArena(The_Pinned_Arena()));
+                    MultiFab::Copy(ld.host_gmf, ld.gmf, 0, 0, 3, 0);
+                    ld.host_mask.define(ld.mask.boxArray(), ld.mask.DistributionMap(), 1, 0,
+                                        MFInfo().SetArena(The_Pinned_Arena()));
+                    iMultiFab::Copy(ld.host_mask, ld.mask, 0, 0, 1, 0);
+#endif
+                    Gpu::streamSynchronize();
+                    for (int box_index : ld.local_boxes) {
+                        scheduler.submit([&ld, profile_box, box_index] ()
+                        {
+                            profile_box(box_index);
+                            --ld.tasks_left;
+                        });
+                    }
+                }
+                --ld.tasks_left;
+            });
+        }
+
+        if (ilev > 0) {
+            finish_level(ilev-1);
+        }
+    }
+
+    finish_level(nlevs-1);
+    scheduler.wait();
+
+    if (do_boundaries) {
+        Vector<const MultiFab*> gmf_levels;
+        for (auto const& ld : levels) {
+            gmf_levels.push_back(&ld->gmf);
+        }
+
+        BoundaryMap bmap = find_boundaries(pf, gmf_levels, diag_rp::spherical, center,
+                                           diag_rp::boundary_nrays);
+
+        std::string boundary_file = "convgrad_boundaries." +
+            std::filesystem::path(pltfile).filename().string();
+
+        // the columns are labeled by their horizontal position, and the
+        // rays by their angles
+
+        auto const dx_bnd = pf.cellSize(nlevs-1);
+        const Box& fine_domain = pf.probDomain(nlevs-1);
+        Vector<std::string> coord_names;
+        if (diag_rp::spherical) {
+            if (ndims == 1) {
+                coord_names = {"ray"};
+            } else if (ndims == 2) {
+                coord_names = {"phi"};
+            } else {
+                coord_names = {"theta", "phi"};
+            }
+        } else {
+            if (ndims == 1) {
+                coord_names = {"column"};
+            } else if (ndims == 2) {
+                coord_names = {"x"};
+            } else {
+                coord_names = {"x", "y"};
+            }
+        }
+
+        auto coord0 = [&] (int c0) -> Real
+        {
+            if (diag_rp::spherical) {
+                if (ndims == 2) {
+                    return -M_PI + (static_cast<Real>(c0) + 0.5_rt) * 2.0_rt * M_PI / bmap.n0();
+                }
+                if (ndims == 3) {
+                    return (static_cast<Real>(c0) + 0.5_rt) * M_PI / bmap.n0();
+                }
+                return 0.0_rt;
+            }
+            if (ndims == 1) {
+                return 0.0_rt;
+            }
+            return probLo[0] + (static_cast<Real>(c0 + fine_domain.smallEnd(0)) + 0.5_rt) * dx_bnd[0];
+        };
+
+        auto coord1 = [&] (int c1) -> Real
+        {
+            if (diag_rp::spherical) {
+                return -M_PI + (static_cast<Real>(c1) + 0.5_rt) * 2.0_rt * M_PI / bmap.n1();
+            }
+            return probLo[1] + (static_cast<Real>(c1 + fine_domain.smallEnd(1)) + 0.5_rt) * dx_bnd[1];
+        };
+
+        bmap.write(boundary_file, coord_names, coord0, coord1);
+    }
+
+    if (slice) {
+        for (int ilev = 0; ilev < nlevs; ++ilev) {
+            slice->add_level(ilev, levels[ilev]->gmf);
+        }
+        std::string slice_file = (slice->isRay() ? "convgrad_ray." : "convgrad_slice.") +
+            std::filesystem::path(pltfile).filename().string();
+        slice->write(slice_file, gvarnames, pf.time());
+        amrex::Print() << "wrote " << slice_file << std::endl;
+    }
+
+    if (do_profile) {
+        profile.reduce();
+        std::string profile_file = "convgrad_profile." +
+            std::filesystem::path(pltfile).filename().string();
+        profile.write(profile_file, gvarnames);
+    }
+
+    // the outputs that weren't handed to the writer
+
+    if (!write_plotfile) {
+        for (auto& ld : levels) {
+            pool.release(std::move(ld->gmf));
+        }
+    }
+}
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include <AMReX.H>
+#include <AMReX_Array.H>
+#include <AMReX_GpuContainers.H>
+#include <AMReX_Print.H>
+#include <AMReX_PlotFileUtil.H>
+#include <AMReX_Vector.H>
+
+#include <extern_parameters.H>
+
+#include <network.H>
+#include <eos.H>
+
+#include <amrex_astro_util.H>
+#include <diag_plotfile.H>
+#include <plotfile_catalog.H>
+#include <plotfile_writer.H>
+
+#include <derive_expr.H>
+
+using namespace amrex;
+
+// the maximum number of inputs + derived fields in one evaluation
+constexpr int derive_max_vars = 64;
+
+// the EOS outputs that an expression can refer to.  A plotfile
+// component with the same name takes precedence.
+const Vector<std::string> eos_field_names{"p", "e", "cv", "cp", "gam1",
+                                          "dpdT", "dpdr", "cs", "s", "h"};
+
+AMREX_GPU_HOST_DEVICE AMREX_FORCE_INLINE
+Real eos_field (const eos_t& eos_state, int field)
+{
+    switch (field) {
+    case 0: return eos_state.p;
+    case 1: return eos_state.e;
+    case 2: return eos_state.cv;
+    case 3: return eos_state.cp;
+    case 4: return eos_state.gam1;
+    case 5: return eos_state.dpdT;
+    case 6: return eos_state.dpdr;
+    case 7: return eos_state.cs;
+    case 8: return eos_state.s;
+    case 9: return eos_state.h;
+    default: return 0.0_rt;
+    }
+}
+
+void process_plotfile(const std::string& pltfile, PlotfileWriter& writer)
+{
+
+    std::string outfile = "derived." +
+        std::filesystem::path(pltfile).filename().string();
+
+    DiagPlotFile pf(pltfile, diag_rp::max_level, diag_rp::coarsen);
+
+    const int ndims = pf.spaceDim();
+    AMREX_ALWAYS_ASSERT(ndims <= AMREX_SPACEDIM);
+
+    const int nlevs = pf.finestLevel() + 1;
+
+    const Vector<std::string>& var_names_pf = pf.varNames();
+
+    // the names an expression can use for the plotfile components.
+    // rho and T are aliases for whatever the density and temperature
+    // are called in this plotfile.
+
+    std::map<std::string, int> pf_names;
+    for (int n = 0; n < static_cast<int>(var_names_pf.size()); ++n) {
+        auto [it, inserted] = pf_names.emplace(derive_sanitize(var_names_pf[n]), n);
+        if (!inserted) {
+            amrex::Error("derive: the plotfile components " + var_names_pf[it->second] + " and " +
+                         var_names_pf[n] + " both have the name " + it->first + " in expressions");
+        }
+    }
+
+    int dens_comp = get_dens_index(var_names_pf);
+    int temp_comp = get_temp_index(var_names_pf);
+    pf_names.emplace("rho", dens_comp);
+    pf_names.emplace("T", temp_comp);
+
+    auto is_input = [&] (const std::string& name) -> bool
+    {
+        return pf_names.count(name) > 0 ||
+            std::find(eos_field_names.cbegin(), eos_field_names.cend(), name) != eos_field_names.cend();
+    };
+
+    DeriveCompiler<decltype(is_input)> compiler(is_input);
+    compiler.compile(diag_rp::derive);
+
+    if (compiler.nslots() > derive_max_vars) {
+        amrex::Error("derive: too many variables in the expressions");
+    }
+
+    // sort the inputs into the plotfile components we need to read and
+    // the EOS outputs we need to compute.  We only read a component once,
+    // even if it is also needed as an EOS input or goes by more than one
+    // name (e.g. rho and density), in which case it fills every slot.
+
+    Vector<int> read_comps;
+    Vector<int> read_pos;
+    Vector<int> read_slots;
+
+    auto add_read = [&] (int comp, int slot) -> int
+    {
+        int pos = static_cast<int>(read_comps.size());
+        auto it = std::find(read_comps.begin(), read_comps.end(), comp);
+        if (it != read_comps.end()) {
+            pos = static_cast<int>(std::distance(read_comps.begin(), it));
+        } else {
+            read_comps.push_back(comp);
+        }
+        if (slot >= 0) {
+            read_pos.push_back(pos);
+            read_slots.push_back(slot);
+        }
+        return pos;
+    };
+
+    Vector<int> eos_slots;
+    Vector<int> eos_ids;
+
+    for (auto const& [name, slot] : compiler.inputs()) {
+        if (auto it = pf_names.find(name); it != pf_names.end()) {
+            add_read(it->second, slot);
+        } else {
+            auto id = std::distance(eos_field_names.cbegin(),
+                                    std::find(eos_field_names.cbegin(), eos_field_names.cend(), name));
+            eos_slots.push_back(slot);
+            eos_ids.push_back(static_cast<int>(id));
+        }
+    }
+
+    const int neos = static_cast<int>(eos_slots.size());
+
+    // the EOS is only called if an expression needs one of its outputs
+
+    int eos_dens{-1};
+    int eos_temp{-1};
+    GpuArray<int, NumSpec> eos_spec{};
+    if (neos > 0) {
+        int spec_comp = get_spec_index(var_names_pf);
+        eos_dens = add_read(dens_comp, -1);
+        eos_temp = add_read(temp_comp, -1);
+        for (int n = 0; n < NumSpec; ++n) {
+            eos_spec[n] = add_read(spec_comp+n, -1);
+        }
+    }
+
+    const int nread = static_cast<int>(read_comps.size());
+    const int nassign = static_cast<int>(read_slots.size());
+
+    const Vector<std::string>& gvarnames = compiler.names();
+    const int nout = static_cast<int>(gvarnames.size());
+
+    amrex::Print() << "evaluating " << nout << " derived fields from "
+                   << nread << " plotfile components"
+                   << (neos > 0 ? " and the EOS" : "") << std::endl;
+
+    // copy the program and the slot maps to the device
+
+    Gpu::DeviceVector<DeriveInstr> code_d(compiler.code().size());
+    Gpu::DeviceVector<int> read_pos_d(read_pos.size());
+    Gpu::DeviceVector<int> read_slots_d(read_slots.size());
+    Gpu::DeviceVector<int> eos_slots_d(eos_slots.size());
+    Gpu::DeviceVector<int> eos_ids_d(eos_ids.size());
+    Gpu::DeviceVector<int> out_slots_d(compiler.slots().size());
+
+    Gpu::copy(Gpu::hostToDevice, compiler.code().begin(), compiler.code().end(), code_d.begin());
+    Gpu::copy(Gpu::hostToDevice, read_pos.begin(), read_pos.end(), read_pos_d.begin());
+    Gpu::copy(Gpu::hostToDevice, read_slots.begin(), read_slots.end(), read_slots_d.begin());
+    Gpu::copy(Gpu::hostToDevice, eos_slots.begin(), eos_slots.end(), eos_slots_d.begin());
+    Gpu::copy(Gpu::hostToDevice, eos_ids.begin(), eos_ids.end(), eos_ids_d.begin());
+    Gpu::copy(Gpu::hostToDevice, compiler.slots().begin(), compiler.slots().end(), out_slots_d.begin());
+
+    const DeriveInstr* code = code_d.data();
+    const int ncode = static_cast<int>(code_d.size());
+    const int* rpos = read_pos_d.data();
+    const int* rslot = read_slots_d.data();
+    const int* eslot = eos_slots_d.data();
+    const int* eid = eos_ids_d.data();
+    const int* oslot = out_slots_d.data();
+
+    // the expressions are pointwise, so no ghost cells are needed
+
+    Array<int,AMREX_SPACEDIM> is_periodic{AMREX_D_DECL(0,0,0)};
+    for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+        is_periodic[idim] = 1;
+    }
+
+    Vector<Geometry> geom;
+    Vector<BoxArray> grids;
+    Vector<int> level_steps;
+    Vector<IntVect> ref_ratio;
+    for (int ilev = 0; ilev < nlevs; ++ilev) {
+        geom.emplace_back(pf.probDomain(ilev), RealBox(pf.probLo(),pf.probHi()),
+                          pf.coordSys(), is_periodic);
+        grids.push_back(pf.boxArray(ilev));
+        level_steps.push_back(pf.levelStep(ilev));
+        if (ilev < pf.finestLevel()) {
+            ref_ratio.push_back(IntVect(pf.refRatio(ilev)));
+            for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+                ref_ratio[ilev][idim] = 1;
+            }
+        }
+    }
+
+    writer.setAugmentTarget(pltfile, "derived");
+    writer.begin(outfile, grids, gvarnames, geom, pf.time(), level_steps, ref_ratio);
+
+    for (int ilev = 0; ilev < nlevs; ++ilev)
+    {
+
+        // only the components the expressions refer to are read
+
+        MultiFab src_mf(pf.boxArray(ilev), pf.DistributionMap(ilev), std::max(nread, 1), 0);
+        for (int n = 0; n < nread; ++n) {
+            MultiFab smf = pf.get(ilev, var_names_pf[read_comps[n]]);
+            MultiFab::Copy(src_mf, smf, 0, n, 1, 0);
+        }
+
+        MultiFab gmf(pf.boxArray(ilev), pf.DistributionMap(ilev), nout, 0);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel
+#endif
+        for (MFIter mfi(gmf, TilingIfNotGPU()); mfi.isValid(); ++mfi) {
+            Box const& bx = mfi.tilebox();
+
+            auto const& ga = gmf.array(mfi);
+            auto const& src = src_mf.const_array(mfi);
+
+            amrex::ParallelFor(bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+            {
+                Real vars[derive_max_vars];
+
+                for (int n = 0; n < nassign; ++n) {
+                    vars[rslot[n]] = src(i,j,k,rpos[n]);
+                }
+
+                if (neos > 0) {
+                    eos_t eos_state;
+                    eos_state.rho = src(i,j,k,eos_dens);
+                    eos_state.T = src(i,j,k,eos_temp);
+                    for (int n = 0; n < NumSpec; ++n) {
+                        eos_state.xn[n] = src(i,j,k,eos_spec[n]);
+                    }
+                    eos(eos_input_rt, eos_state);
+
+                    for (int n = 0; n < neos; ++n) {
+                        vars[eslot[n]] = eos_field(eos_state, eid[n]);
+                    }
+                }
+
+                derive_eval(code, ncode, vars);
+
+                for (int m = 0; m < nout; ++m) {
+                    ga(i,j,k,m) = vars[oslot[m]];
+                }
+            });
+        }
+
+        writer.write_level(ilev, std::move(gmf));
+    }
+}
+
+void main_main()
+{
+
+    auto pltfiles = select_plotfiles(diag_rp::plotfile, diag_rp::catalog, diag_rp::query);
+
+    // one writer is shared by all of the plotfiles, so the output of one
+    // plotfile goes to disk while the next one is processed
+
+    PlotfileWriter writer(diag_rp::async_output);
+    writer.setFormat(diag_rp::output_format, diag_rp::float_fields, diag_rp::hdf5_compression);
+
+    for (auto const& pltfile : pltfiles) {
+        amrex::Print() << "processing " << pltfile << std::endl;
+        process_plotfile(pltfile, writer);
+    }
+
+    writer.wait();
+}
+
+int main (int argc, char* argv[])
+{
+    amrex::SetVerbose(0);
+    amrex::Initialize(argc, argv, true, MPI_COMM_WORLD, enable_async_output);
+
+    // initialize the runtime parameters
+
+    init_extern_parameters();
+
+    // initialize C++ Microphysics
+
+    eos_init(diag_rp::small_temp, diag_rp::small_dens);
+    network_init();
+
+    main_main();
+    amrex::Finalize();
+}
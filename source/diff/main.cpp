@@ -0,0 +1,362 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+
+#include <AMReX.H>
+#include <AMReX_BoxArray.H>
+#include <AMReX_ParallelDescriptor.H>
+#include <AMReX_Print.H>
+#include <AMReX_Vector.H>
+
+#include <extern_parameters.H>
+
+#include <plotfile_mmap.H>
+
+using namespace amrex;
+
+///
+/// the norms of the difference of one variable on one level, and the
+/// same norms of the reference (for the relative norms)
+///
+struct DiffNorms
+{
+    // sum |a - b|, sum (a - b)^2, sum |b|, sum b^2
+    enum : int { l1 = 0, l2, ref_l1, ref_l2, nsums };
+
+    // max |a - b|, max |b|
+    enum : int { linf = 0, ref_linf, nmaxes };
+
+    Real sum[nsums]{};
+    Real max[nmaxes]{};
+    Long nfail{0};
+
+    void merge (const DiffNorms& other)
+    {
+        for (int n = 0; n < nsums; ++n) {
+            sum[n] += other.sum[n];
+        }
+        for (int n = 0; n < nmaxes; ++n) {
+            max[n] = amrex::max(max[n], other.max[n]);
+        }
+        nfail += other.nfail;
+    }
+};
+
+///
+/// compare the plotfile diag.plotfile with the reference diag.reference
+/// and return the exit status: 0 if they agree to within the tolerances
+/// and 1 otherwise.
+///
+/// The FABs are read one at a time through MappedPlotfile (straight
+/// from the memory map when the data is native, otherwise through
+/// FArrayBox::readFrom, as PlotFileData would), so each thread only
+/// holds one pair of FABs.  The FABs of a level are split between the
+/// ranks, and the threads of a rank share its block.
+///
+int main_main()
+{
+
+    MappedPlotfile pa(diag_rp::plotfile);
+    MappedPlotfile pb(diag_rp::reference);
+
+    const Real abs_tol = diag_rp::abs_tol;
+    const Real rel_tol = diag_rp::rel_tol;
+    const bool early_exit = diag_rp::early_exit;
+
+    bool differ{false};
+
+    // the variables to compare, by name, and their components in each
+    // plotfile
+
+    auto const& names_a = pa.varNames();
+    auto const& names_b = pb.varNames();
+
+    auto find_var = [] (const Vector<std::string>& names, const std::string& name) -> int
+    {
+        auto idx = std::find(names.cbegin(), names.cend(), name);
+        return (idx == names.cend()) ? -1 : static_cast<int>(std::distance(names.cbegin(), idx));
+    };
+
+    Vector<std::string> vars;
+    if (diag_rp::variables.empty()) {
+        for (auto const& name : names_a) {
+            if (find_var(names_b, name) >= 0) {
+                vars.push_back(name);
+            } else {
+                amrex::Print() << "variable " << name << " is only in " << diag_rp::plotfile << std::endl;
+                differ = true;
+            }
+        }
+        for (auto const& name : names_b) {
+            if (find_var(names_a, name) < 0) {
+                amrex::Print() << "variable " << name << " is only in " << diag_rp::reference << std::endl;
+                differ = true;
+            }
+        }
+    } else {
+        std::istringstream iss(diag_rp::variables);
+        std::string name;
+        while (iss >> name) {
+            if (find_var(names_a, name) < 0 || find_var(names_b, name) < 0) {
+                amrex::Error("diff: variable " + name + " is not in both plotfiles");
+            }
+            vars.push_back(name);
+        }
+    }
+
+    const int nvars = static_cast<int>(vars.size());
+    Vector<int> comp_a(nvars);
+    Vector<int> comp_b(nvars);
+    for (int v = 0; v < nvars; ++v) {
+        comp_a[v] = find_var(names_a, vars[v]);
+        comp_b[v] = find_var(names_b, vars[v]);
+    }
+
+    int finest_level = std::min(pa.finestLevel(), pb.finestLevel());
+    if (pa.finestLevel() != pb.finestLevel()) {
+        amrex::Print() << "the plotfiles have " << pa.finestLevel() + 1 << " and "
+                       << pb.finestLevel() + 1 << " levels" << std::endl;
+        differ = true;
+    }
+    if (diag_rp::max_level >= 0) {
+        finest_level = std::min(finest_level, static_cast<int>(diag_rp::max_level));
+    }
+
+    const int nprocs = ParallelDescriptor::NProcs();
+    const int myproc = ParallelDescriptor::MyProc();
+
+    bool stopped{false};
+
+    for (int ilev = 0; ilev <= finest_level && !stopped; ++ilev) {
+
+        if (pa.header().domain[ilev] != pb.header().domain[ilev]) {
+            amrex::Print() << "level " << ilev << ": the domains differ, "
+                           << pa.header().domain[ilev] << " and " << pb.header().domain[ilev] << std::endl;
+            differ = true;
+            continue;
+        }
+
+        // the grids may differ (e.g. after a restart with a different
+        // regrid), so each FAB of a is compared with the FABs of b that
+        // it intersects
+
+        const int nfabs_a = pa.nFabs(ilev);
+        BoxList bl_b;
+        Long npts_a{0};
+        Long npts_b{0};
+        for (int n = 0; n < nfabs_a; ++n) {
+            npts_a += pa.fabMeta(ilev, n).box.numPts();
+        }
+        for (int n = 0; n < pb.nFabs(ilev); ++n) {
+            bl_b.push_back(pb.fabMeta(ilev, n).box);
+            npts_b += pb.fabMeta(ilev, n).box.numPts();
+        }
+        const BoxArray ba_b(std::move(bl_b));
+
+        const int ibegin = static_cast<int>((static_cast<Long>(nfabs_a) * myproc) / nprocs);
+        const int iend = static_cast<int>((static_cast<Long>(nfabs_a) * (myproc+1)) / nprocs);
+
+        Vector<DiffNorms> norms(nvars);
+        Long ncompared{0};
+        std::atomic<bool> stop{false};
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel
+#endif
+        {
+            Vector<DiffNorms> local(nvars);
+            Long local_compared{0};
+
+#ifdef AMREX_USE_OMP
+#pragma omp for schedule(dynamic)
+#endif
+            for (int ia = ibegin; ia < iend; ++ia) {
+                if (early_exit && stop) {
+                    continue;
+                }
+
+                const Box& box_a = pa.fabMeta(ilev, ia).box;
+                const auto isects = ba_b.intersections(box_a);
+                if (isects.empty()) {
+                    continue;
+                }
+
+                // creating the views isn't thread safe, but comparing
+                // them is.  The FAB of a is made once for all of the
+                // FABs of b it overlaps.
+
+                FabView va;
+#ifdef AMREX_USE_OMP
+#pragma omp critical (diff_views)
+#endif
+                {
+                    va = pa.fab(ilev, ia);
+                }
+                const auto a = va.const_array();
+
+                for (auto const& [ib, isect] : isects) {
+
+                    FabView vb;
+#ifdef AMREX_USE_OMP
+#pragma omp critical (diff_views)
+#endif
+                    {
+                        vb = pb.fab(ilev, ib);
+                    }
+
+                    const auto b = vb.const_array();
+                    const auto lo = amrex::lbound(isect);
+                    const auto hi = amrex::ubound(isect);
+
+                    local_compared += isect.numPts();
+
+                    for (int v = 0; v < nvars; ++v) {
+                        const int ca = comp_a[v];
+                        const int cb = comp_b[v];
+                        DiffNorms& dn = local[v];
+
+                        for (int k = lo.z; k <= hi.z; ++k) {
+                            for (int j = lo.y; j <= hi.y; ++j) {
+                                for (int i = lo.x; i <= hi.x; ++i) {
+                                    const Real x = a(i,j,k,ca);
+                                    const Real y = b(i,j,k,cb);
+
+                                    // NaNs only agree with NaNs
+                                    Real d{0.0_rt};
+                                    if (std::isnan(x) || std::isnan(y)) {
+                                        if (!(std::isnan(x) && std::isnan(y))) {
+                                            d = std::numeric_limits<Real>::infinity();
+                                        }
+                                    } else {
+                                        d = std::abs(x - y);
+                                    }
+                                    const Real ref = std::isnan(y) ? 0.0_rt : std::abs(y);
+
+                                    dn.sum[DiffNorms::l1] += d;
+                                    dn.sum[DiffNorms::l2] += d * d;
+                                    dn.sum[DiffNorms::ref_l1] += ref;
+                                    dn.sum[DiffNorms::ref_l2] += ref * ref;
+                                    dn.max[DiffNorms::linf] = amrex::max(dn.max[DiffNorms::linf], d);
+                                    dn.max[DiffNorms::ref_linf] = amrex::max(dn.max[DiffNorms::ref_linf], ref);
+
+                                    if (d > abs_tol + rel_tol * ref) {
+                                        dn.nfail += 1;
+                                    }
+                                }
+                            }
+                        }
+
+                        if (dn.nfail > 0) {
+                            stop = true;
+                        }
+                    }
+                }
+            }
+
+#ifdef AMREX_USE_OMP
+#pragma omp critical (diff_reduce)
+#endif
+            {
+                for (int v = 0; v < nvars; ++v) {
+                    norms[v].merge(local[v]);
+                }
+                ncompared += local_compared;
+            }
+        }
+
+        // combine the ranks
+
+        Vector<Real> sums;
+        Vector<Real> maxes;
+        Vector<Long> counts{ncompared};
+        for (auto const& dn : norms) {
+            sums.insert(sums.end(), dn.sum, dn.sum + DiffNorms::nsums);
+            maxes.insert(maxes.end(), dn.max, dn.max + DiffNorms::nmaxes);
+            counts.push_back(dn.nfail);
+        }
+        ParallelDescriptor::ReduceRealSum(sums.data(), static_cast<int>(sums.size()));
+        ParallelDescriptor::ReduceRealMax(maxes.data(), static_cast<int>(maxes.size()));
+        ParallelDescriptor::ReduceLongSum(counts.data(), static_cast<int>(counts.size()));
+
+        ncompared = counts[0];
+        Long nfail{0};
+        for (int v = 0; v < nvars; ++v) {
+            nfail += counts[1+v];
+        }
+
+        // a level stopped early hasn't compared all of its zones, so the
+        // count says nothing about the grids
+
+        amrex::Print() << "level " << ilev << ": " << ncompared << " zones compared";
+        if (early_exit && nfail > 0) {
+            amrex::Print() << ", stopped at the first difference";
+            stopped = true;
+        } else if (ncompared != npts_a || ncompared != npts_b) {
+            amrex::Print() << " (the grids differ: " << npts_a << " and " << npts_b << " zones)";
+            differ = true;
+        }
+        amrex::Print() << std::endl;
+
+        amrex::Print() << "  " << std::setw(24) << std::left << "variable" << std::right
+                       << std::setw(14) << "L1" << std::setw(14) << "L2" << std::setw(14) << "Linf"
+                       << std::setw(14) << "rel L1" << std::setw(14) << "rel L2" << std::setw(14) << "rel Linf"
+                       << std::setw(12) << "nfail" << std::endl;
+
+        // the L1 and L2 norms are averages over the zones, and the
+        // relative norms are divided by the same norm of the reference
+
+        auto ratio = [] (Real num, Real den) -> Real
+        {
+            if (den > 0.0_rt) {
+                return num / den;
+            }
+            return (num > 0.0_rt) ? std::numeric_limits<Real>::infinity() : 0.0_rt;
+        };
+
+        const Real nzones = amrex::max(static_cast<Real>(ncompared), 1.0_rt);
+
+        for (int v = 0; v < nvars; ++v) {
+            const Real* s = &sums[static_cast<std::size_t>(v) * DiffNorms::nsums];
+            const Real* m = &maxes[static_cast<std::size_t>(v) * DiffNorms::nmaxes];
+
+            amrex::Print() << "  " << std::setw(24) << std::left << vars[v] << std::right
+                           << std::setprecision(5) << std::scientific
+                           << std::setw(14) << s[DiffNorms::l1] / nzones
+                           << std::setw(14) << std::sqrt(s[DiffNorms::l2] / nzones)
+                           << std::setw(14) << m[DiffNorms::linf]
+                           << std::setw(14) << ratio(s[DiffNorms::l1], s[DiffNorms::ref_l1])
+                           << std::setw(14) << ratio(std::sqrt(s[DiffNorms::l2]), std::sqrt(s[DiffNorms::ref_l2]))
+                           << std::setw(14) << ratio(m[DiffNorms::linf], m[DiffNorms::ref_linf])
+                           << std::setw(12) << counts[1+v] << std::endl;
+        }
+
+        if (nfail > 0) {
+            differ = true;
+        }
+    }
+
+    amrex::Print() << (differ ? "the plotfiles differ" : "the plotfiles agree") << std::endl;
+
+    return differ ? 1 : 0;
+}
+
+int main (int argc, char* argv[])
+{
+    amrex::SetVerbose(0);
+    amrex::Initialize(argc, argv);
+
+    // initialize the runtime parameters
+
+    init_extern_parameters();
+
+    const int status = main_main();
+
+    amrex::Finalize();
+
+    return status;
+}
@@ -2,7 +2,9 @@
 // Process a sedov problem to produce rho, u, and p as a
 // function of r, for comparison to the analytic solution.
 //
+#include <filesystem>
 #include <iostream>
+#include <memory>
 // #include <stringstream>
 #include <regex>
 #include <string>
@@ -11,6 +13,10 @@
 #include <AMReX_ParallelDescriptor.H>
 
 #include <amrex_astro_util.H>
+#include <diag_plotfile.H>
+#include <eos_surrogate.H>
+#include <plotfile_mmap.H>
+#include <slice_extract.H>
 
 #include <extern_parameters.H>
 
@@ -40,7 +46,7 @@ int main(int argc, char* argv[])
 
     // read the plotfile metadata
 
-    PlotFileData pf(diag_rp::plotfile);
+    DiagPlotFile pf(diag_rp::plotfile, diag_rp::max_level, diag_rp::coarsen);
 
     int fine_level = pf.finestLevel();
     const int dim = pf.spaceDim();
@@ -58,6 +64,46 @@ int main(int argc, char* argv[])
     int temp_comp = get_temp_index(var_names_pf);
     int spec_comp = get_spec_index(var_names_pf);
 
+    // in slice mode only the grids near the slice are read, the EOS is
+    // only called on the slice, and the pressure, sound speed and
+    // Gamma_1 there are output
+
+    std::unique_ptr<SliceExtractor> slice;
+    if (!diag_rp::slice.empty()) {
+        slice = std::make_unique<SliceExtractor>(pf, diag_rp::slice);
+        pf.restrict_to(slice->box(), 0);
+        fine_level = pf.finestLevel();
+    }
+
+    Vector<std::string> slice_varnames{"pressure", "soundspeed", "Gamma_1"};
+
+    // the data is only read, so unless it has to be coarsened we map
+    // the FABs of the plotfile rather than reading them into MultiFabs.
+    // A restricted view reads through the mapping itself.
+
+    std::unique_ptr<MappedPlotfile> mapped;
+    if (diag_rp::use_mmap && pf.coarsenFactor() == 1 && !slice) {
+        mapped = std::make_unique<MappedPlotfile>(diag_rp::plotfile);
+    }
+
+    // with diag.eos_surrogate the EOS is tabulated for the states in the
+    // plotfile and interpolated where that is accurate enough.  Building
+    // the tables reads the data once.
+
+    std::unique_ptr<EosSurrogate> surrogate;
+    EosTable eos_table;
+    if (diag_rp::eos_surrogate) {
+        EosSurrogateParams params;
+        params.max_clusters = diag_rp::eos_max_clusters;
+        params.comp_tol = diag_rp::eos_comp_tol;
+        params.table_size = diag_rp::eos_table_size;
+        params.tol = diag_rp::eos_tol;
+        params.check_fraction = diag_rp::eos_check_fraction;
+        surrogate = std::make_unique<EosSurrogate>(pf, dens_comp, temp_comp, spec_comp, params);
+        surrogate->report();
+        eos_table = surrogate->host_table();
+    }
+
     // we will use a mask that tells us if a zone on the current level
     // is covered by data on a finer level.
 
@@ -71,13 +117,27 @@ int main(int argc, char* argv[])
             const iMultiFab mask = makeFineMask(pf.boxArray(ilev), pf.DistributionMap(ilev),
                                                 pf.boxArray(ilev+1), ratio);
 
-            const MultiFab& lev_data_mf = pf.get(ilev);
+            MultiFab lev_data_mf;
+            if (!mapped) {
+                lev_data_mf = pf.get(ilev);
+            }
 
-            for (MFIter mfi(lev_data_mf); mfi.isValid(); ++mfi) {
-                const Box& bx = mfi.validbox();
+            MultiFab slice_mf;
+            if (slice) {
+                slice_mf.define(pf.boxArray(ilev), pf.DistributionMap(ilev),
+                                static_cast<int>(slice_varnames.size()), 0);
+                slice_mf.setVal(0.0_rt);
+            }
+
+            for (MFIter mfi(pf.boxArray(ilev), pf.DistributionMap(ilev)); mfi.isValid(); ++mfi) {
+                const Box bx = mfi.validbox() & pf.region(ilev);
                 if (bx.ok()) {
+                    FabView fab_view;
+                    if (mapped) {
+                        fab_view = mapped->fab(ilev, mfi.index());
+                    }
                     const auto& m = mask.array(mfi);
-                    const auto& fab = lev_data_mf.array(mfi);
+                    const auto& fab = mapped ? fab_view.const_array() : lev_data_mf.const_array(mfi);
                     const auto lo = amrex::lbound(bx);
                     const auto hi = amrex::ubound(bx);
 
@@ -101,7 +161,14 @@ int main(int argc, char* argv[])
                                     eos_state.xn[n] = fab(i,j,k,spec_comp+n);
                                 }
 
-                                eos(eos_input_rt, eos_state);
+                                eos_rt(eos_table, eos_state);
+
+                                if (slice) {
+                                    auto const& sa = slice_mf.array(mfi);
+                                    sa(i,j,k,0) = eos_state.p;
+                                    sa(i,j,k,1) = eos_state.cs;
+                                    sa(i,j,k,2) = eos_state.gam1;
+                                }
 
                                 // } // mask
 
@@ -113,15 +180,33 @@ int main(int argc, char* argv[])
 
             } // MFIter
 
+            if (slice) {
+                slice->add_level(ilev, slice_mf);
+            }
+
         } else {
             // this is the finest level
 
-            const MultiFab& lev_data_mf = pf.get(ilev);
+            MultiFab lev_data_mf;
+            if (!mapped) {
+                lev_data_mf = pf.get(ilev);
+            }
+
+            MultiFab slice_mf;
+            if (slice) {
+                slice_mf.define(pf.boxArray(ilev), pf.DistributionMap(ilev),
+                                static_cast<int>(slice_varnames.size()), 0);
+                slice_mf.setVal(0.0_rt);
+            }
 
-            for (MFIter mfi(lev_data_mf); mfi.isValid(); ++mfi) {
-                const Box& bx = mfi.validbox();
+            for (MFIter mfi(pf.boxArray(ilev), pf.DistributionMap(ilev)); mfi.isValid(); ++mfi) {
+                const Box bx = mfi.validbox() & pf.region(ilev);
                 if (bx.ok()) {
-                    const auto& fab = lev_data_mf.array(mfi);
+                    FabView fab_view;
+                    if (mapped) {
+                        fab_view = mapped->fab(ilev, mfi.index());
+                    }
+                    const auto& fab = mapped ? fab_view.const_array() : lev_data_mf.const_array(mfi);
                     const auto lo = amrex::lbound(bx);
                     const auto hi = amrex::ubound(bx);
 
@@ -137,7 +222,14 @@ int main(int argc, char* argv[])
                                     eos_state.xn[n] = fab(i,j,k,spec_comp+n);
                                 }
 
-                                eos(eos_input_rt, eos_state);
+                                eos_rt(eos_table, eos_state);
+
+                                if (slice) {
+                                    auto const& sa = slice_mf.array(mfi);
+                                    sa(i,j,k,0) = eos_state.p;
+                                    sa(i,j,k,1) = eos_state.cs;
+                                    sa(i,j,k,2) = eos_state.gam1;
+                                }
 
                             }
                         }
@@ -147,11 +239,22 @@ int main(int argc, char* argv[])
 
             } // MFIter
 
+            if (slice) {
+                slice->add_level(ilev, slice_mf);
+            }
+
 
         }
 
     } // level loop
 
+    if (slice) {
+        std::string slice_file = (slice->isRay() ? "eos_ray." : "eos_slice.") +
+            std::filesystem::path(diag_rp::plotfile).filename().string();
+        slice->write(slice_file, slice_varnames, pf.time());
+        amrex::Print() << "wrote " << slice_file << std::endl;
+    }
+
 
 
     // destroy timer for profiling
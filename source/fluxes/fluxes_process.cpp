@@ -0,0 +1,526 @@
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <AMReX.H>
+#include <AMReX_Array.H>
+#include <AMReX_FillPatchUtil.H>
+#include <AMReX_Print.H>
+#include <AMReX_PlotFileUtil.H>
+#include <AMReX_Vector.H>
+
+#include <extern_parameters.H>
+
+#include <network.H>
+#include <eos.H>
+#include <conductivity.H>
+
+#include <fundamental_constants.H>
+
+#include <amrex_astro_util.H>
+#include <diag_plotfile.H>
+#include <gravity_profile.H>
+#include <horizontal_average.H>
+#include <plotfile_writer.H>
+#include <slice_extract.H>
+
+#include <fluxes_process.H>
+
+using namespace amrex;
+
+inline int
+get_dT_index(const std::vector<std::string>& var_names_pf) {
+
+    // tpert is optional -- -1 means we need to construct it from the
+    // horizontal average of T
+
+    auto idx = std::find(var_names_pf.cbegin(), var_names_pf.cend(), "tpert");
+    if (idx == var_names_pf.cend()) {
+        return -1;
+    }
+    return static_cast<int>(std::distance(var_names_pf.cbegin(), idx));
+}
+
+void fluxes_plotfile (const std::string& pltfile, PlotfileWriter& writer,
+                      MultiFabPool& pool)
+{
+
+    std::string outfile = pltfile + "/fluxes";
+    std::cout << outfile << std::endl;
+
+    DiagPlotFile pf(pltfile, diag_rp::max_level, diag_rp::coarsen);
+    if (diag_rp::use_pool) {
+        pf.setPool(&pool);
+    }
+
+    const int ndims = pf.spaceDim();
+    AMREX_ALWAYS_ASSERT(ndims <= AMREX_SPACEDIM);
+
+    Vector<std::string> varnames;
+    varnames = pf.varNames();
+
+    // find variable indices
+    // We want:
+    // density, temperature, pressure, species
+    // vertical velocity, temperature perturbation
+    // we will assume here that the species are contiguous, so we will find
+    // the index of the first species
+
+    const Vector<std::string>& var_names_pf = pf.varNames();
+
+    int dens_comp = get_dens_index(var_names_pf);
+    int temp_comp = get_temp_index(var_names_pf);
+    int pres_comp = get_pres_index(var_names_pf);
+    int spec_comp = get_spec_index(var_names_pf);
+    int dT_comp = get_dT_index(var_names_pf);
+
+    int v_comp{-1};
+    if (ndims == 2) {
+        v_comp = get_vy_index(var_names_pf);
+    } else if (ndims == 3) {
+        // z is the vertical
+       v_comp = get_vz_index(var_names_pf);
+    }
+
+    // for spherical problems we need all of the velocity components to
+    // construct the radial velocity
+
+    GpuArray<int, AMREX_SPACEDIM> vel_comps{};
+    if (diag_rp::spherical) {
+        vel_comps[0] = get_vx_index(var_names_pf);
+        if (ndims >= 2) {
+            vel_comps[1] = get_vy_index(var_names_pf);
+        }
+        if (ndims == 3) {
+            vel_comps[2] = get_vz_index(var_names_pf);
+        }
+    }
+
+    // gravity.  For spherical problems we construct g(r) from the
+    // enclosed mass.  For plane-parallel problems, g is constant and
+    // taken from diag.grav_const, or the job_info file if that is not
+    // set.
+
+    auto const probLo = pf.probLo();
+    auto const probHi = pf.probHi();
+
+    Vector<Real> center(AMREX_SPACEDIM, 0.0_rt);
+    for (int idim = 0; idim < ndims; ++idim) {
+        center[idim] = 0.5_rt * (probLo[idim] + probHi[idim]);
+    }
+    if (pf.coordSys() == 1) {
+        // axisymmetric -- the center is on the axis
+        center[0] = probLo[0];
+    }
+    GpuArray<Real, AMREX_SPACEDIM> ctr{};
+    for (int idim = 0; idim < AMREX_SPACEDIM; ++idim) {
+        ctr[idim] = center[idim];
+    }
+
+    std::unique_ptr<GravityProfile> grav_profile;
+    GravityTable grav_table;
+    Real grav_const = std::abs(diag_rp::grav_const);
+
+    if (diag_rp::spherical) {
+        grav_profile = std::make_unique<GravityProfile>(pf, center);
+        grav_table = grav_profile->table();
+        amrex::Print() << "total mass = " << grav_profile->total_mass() << std::endl;
+    } else if (grav_const == 0.0_rt) {
+        auto grav = GetVarFromJobInfo(pltfile, "maestro.grav_const");
+        if (!grav.empty()) {
+            grav_const = std::abs(std::stod(grav));
+        } else {
+            amrex::Print() << "no gravity available, Hp and g will be zero" << std::endl;
+        }
+    }
+
+    const bool use_grav_table = diag_rp::spherical;
+
+    // the fluctuations about the horizontal (or shell) averages.  The
+    // averages of T, the vertical (or radial) velocity and rho are
+    // computed in one pass over the data, and the fluctuations are
+    // formed in the flux kernel below
+
+    const bool temp_from_mean = (diag_rp::mean_temp < 0) ? (dT_comp < 0) : (diag_rp::mean_temp != 0);
+    const bool vel_from_mean = diag_rp::mean_vel != 0;
+    const bool dens_from_mean = diag_rp::mean_dens != 0;
+
+    if (!temp_from_mean && dT_comp < 0) {
+        amrex::Error("Error: could not find tpert component, use diag.mean_temp=1");
+    }
+
+    constexpr int mean_T = 0;
+    constexpr int mean_v = 1;
+    constexpr int mean_rho = 2;
+
+    std::unique_ptr<HorizontalAverage> averages;
+    AverageTable avg_table;
+
+    if (temp_from_mean || vel_from_mean || dens_from_mean) {
+        const bool spherical = diag_rp::spherical;
+        averages = std::make_unique<HorizontalAverage>
+            (pf, 3, spherical, center,
+             [=] (const Array4<const Real>& fab, int i, int j, int k,
+                  const Array<Real, AMREX_SPACEDIM>& p, Real* q)
+             {
+                 q[mean_T] = fab(i,j,k,temp_comp);
+                 q[mean_rho] = fab(i,j,k,dens_comp);
+                 if (!spherical) {
+                     q[mean_v] = fab(i,j,k,v_comp);
+                 } else {
+                     Real r2{0.0_rt};
+                     Real vr{0.0_rt};
+                     for (int idim = 0; idim < ndims; ++idim) {
+                         r2 += (p[idim] - ctr[idim]) * (p[idim] - ctr[idim]);
+                         vr += (p[idim] - ctr[idim]) * fab(i,j,k,vel_comps[idim]);
+                     }
+                     q[mean_v] = (r2 > 0.0_rt) ? vr / std::sqrt(r2) : 0.0_rt;
+                 }
+             });
+        avg_table = averages->table();
+    }
+
+    // in slice mode only the grids near the slice are read, and the
+    // fluxes are only evaluated on the slice.  The gravity and the
+    // averages above still use all of the data.
+
+    std::unique_ptr<SliceExtractor> slice;
+    if (!diag_rp::slice.empty()) {
+        slice = std::make_unique<SliceExtractor>(pf, diag_rp::slice);
+        pf.restrict_to(slice->box(), 2);
+    }
+
+    const int nlevs = pf.finestLevel() + 1;
+
+    // create the variable names we will derive and store in the output
+    // file
+
+    Vector<std::string> gvarnames;
+    gvarnames.push_back("Fconv");
+    gvarnames.push_back("Fconv_mlt");
+    gvarnames.push_back("Fkin");
+    gvarnames.push_back("Frad");
+    gvarnames.push_back("Fh1");
+    gvarnames.push_back("Hp");
+    gvarnames.push_back("g");
+    gvarnames.push_back("Fconv_mlt_grad");
+
+    // the fluctuations we construct are output too
+
+    int tpert_out{-1};
+    int rhopert_out{-1};
+    if (temp_from_mean) {
+        tpert_out = static_cast<int>(gvarnames.size());
+        gvarnames.push_back("tpert");
+    }
+    if (dens_from_mean) {
+        rhopert_out = static_cast<int>(gvarnames.size());
+        gvarnames.push_back("rhopert");
+    }
+
+    // interpret the boundary conditions
+
+    BCRec bcr_default;
+    Array<int,AMREX_SPACEDIM> is_periodic{AMREX_D_DECL(0,0,0)};
+    IntVect ng(1);
+    for (int idim = 0; idim < AMREX_SPACEDIM; ++idim) {
+        if (idim < ndims) {
+            bcr_default.setLo(idim, BCType::hoextrapcc);
+            bcr_default.setHi(idim, BCType::hoextrapcc);
+        } else {
+            bcr_default.setLo(idim, BCType::int_dir);
+            bcr_default.setHi(idim, BCType::int_dir);
+            is_periodic[idim] = 1;
+            ng[idim] = 0;
+        }
+    }
+
+    // the output only depends on the grids, so we can start the plotfile
+    // now and hand each level to the writer as soon as it is done
+
+    Vector<Geometry> geom;
+    Vector<BoxArray> grids;
+    Vector<int> level_steps;
+    Vector<IntVect> ref_ratio;
+    for (int ilev = 0; ilev < nlevs; ++ilev) {
+        geom.emplace_back(pf.probDomain(ilev), RealBox(pf.probLo(),pf.probHi()),
+                          pf.coordSys(), is_periodic);
+        grids.push_back(pf.boxArray(ilev));
+        level_steps.push_back(pf.levelStep(ilev));
+        if (ilev < pf.finestLevel()) {
+            ref_ratio.push_back(IntVect(pf.refRatio(ilev)));
+            for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+                ref_ratio[ilev][idim] = 1;
+            }
+        }
+    }
+
+    if (!slice) {
+        writer.setAugmentTarget(pltfile, "fluxes");
+        writer.begin(outfile, grids, gvarnames, geom, pf.time(), level_steps, ref_ratio);
+    }
+
+    // we need the variables constructed with ghost cells
+
+    for (int ilev = 0; ilev < nlevs; ++ilev)
+    {
+
+        // output MultiFab
+
+        MultiFab gmf = pool.acquire(pf.boxArray(ilev), pf.DistributionMap(ilev), static_cast<int>(gvarnames.size()), 0);
+        if (pf.restricted()) {
+            gmf.setVal(0.0_rt);
+        }
+
+        Vector<BCRec> bcr{bcr_default};
+        auto is_per = is_periodic;
+
+        const Geometry& vargeom = geom[ilev];
+
+        PhysBCFunct<GpuBndryFuncFab<FabFillNoOp>> physbcf
+            (vargeom, bcr, GpuBndryFuncFab<FabFillNoOp>(FabFillNoOp{}));
+
+        // fill the pressure and temperature mfs with ghost cells
+        // we also need all of the species.  These and the data read to
+        // fill them come from (and go back to) the pool.
+
+        MultiFab temp_mf = pool.acquire(pf.boxArray(ilev), pf.DistributionMap(ilev), 1, ng);
+        MultiFab pres_mf = pool.acquire(pf.boxArray(ilev), pf.DistributionMap(ilev), 1, ng);
+        MultiFab species_mf = pool.acquire(pf.boxArray(ilev), pf.DistributionMap(ilev), NumSpec, ng);
+        MultiFab vy_mf = pool.acquire(pf.boxArray(ilev), pf.DistributionMap(ilev), 1, ng);
+        MultiFab dT_mf = pool.acquire(pf.boxArray(ilev), pf.DistributionMap(ilev), 1, ng);
+
+        // fill component dst_comp of dst from plotfile variable src_comp
+
+        std::function<void(MultiFab&, int, int)> fill;
+
+        if (ilev == 0) {
+
+            fill = [&] (MultiFab& dst, int src_comp, int dst_comp)
+            {
+                MultiFab smf = pf.get(ilev, var_names_pf[src_comp]);
+                FillPatchSingleLevel(dst, ng, Real(0.0), {&smf}, {Real(0.0)},
+                                     0, dst_comp, 1, vargeom, physbcf, 0);
+                pool.release(std::move(smf));
+            };
+
+        } else {
+
+            fill = [&] (MultiFab& dst, int src_comp, int dst_comp)
+            {
+                auto* mapper = (Interpolater*)(&cell_cons_interp);
+
+                IntVect ratio(pf.refRatio(ilev-1));
+                for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+                    ratio[idim] = 1;
+                }
+
+                Geometry cgeom(pf.probDomain(ilev-1), RealBox(pf.probLo(),pf.probHi()),
+                               pf.coordSys(), is_per);
+                PhysBCFunct<GpuBndryFuncFab<FabFillNoOp>> cphysbcf
+                    (cgeom, bcr, GpuBndryFuncFab<FabFillNoOp>(FabFillNoOp{}));
+
+                MultiFab cmf = pf.get(ilev-1, var_names_pf[src_comp]);
+                MultiFab fmf = pf.get(ilev  , var_names_pf[src_comp]);
+                FillPatchTwoLevels(dst, ng, Real(0.0), {&cmf}, {Real(0.0)},
+                                   {&fmf}, {Real(0.0)}, 0, dst_comp, 1, cgeom, vargeom,
+                                   cphysbcf, 0, physbcf, 0, ratio, mapper, bcr, 0);
+                pool.release(std::move(cmf));
+                pool.release(std::move(fmf));
+            };
+        }
+
+        fill(temp_mf, temp_comp, 0);
+        fill(pres_mf, pres_comp, 0);
+        for (int n = 0; n < NumSpec; ++n) {
+            fill(species_mf, spec_comp+n, n);
+        }
+        fill(vy_mf, v_comp, 0);
+        if (!temp_from_mean) {
+            fill(dT_mf, dT_comp, 0);
+        }
+
+        auto const& dx = pf.cellSize(ilev);
+
+        MultiFab lev_data_mf = pf.get(ilev);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel
+#endif
+        for (MFIter mfi(temp_mf, TilingIfNotGPU()); mfi.isValid(); ++mfi) {
+            // only the zones in the slice region, if we are restricted
+            Box const bx = mfi.tilebox() & pf.region(ilev);
+            if (!bx.ok()) {
+                continue;
+            }
+
+            // output storage
+            auto const& ga = gmf.array(mfi);
+
+            // temperature and pressure with ghost cells
+            auto const& T = temp_mf.const_array(mfi);
+            auto const& P = pres_mf.const_array(mfi);
+
+            // all of the data without ghost cells
+            const auto& fab = lev_data_mf.array(mfi);
+
+            const Real mlt_alpha = diag_rp::mlt_alpha;
+
+            amrex::ParallelFor(bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+            {
+
+                Real dT_dr = 0.0;
+                Real dP_dr = 0.0;
+                Real vel{0.0};
+                Real r_zone{0.0};
+
+                // the height (or radius) used for the horizontal averages
+                Real height{0.0};
+
+                if (!diag_rp::spherical) {
+                    if ( ndims == 2 ) {
+                        // y is the vertical
+                        dT_dr = (T(i,j+1,k) - T(i,j-1,k)) / (2.0*dx[1]);
+                        dP_dr = (P(i,j+1,k) - P(i,j-1,k)) / (2.0*dx[1]);
+                    } else {
+                        // z is the vertical
+                        dT_dr = (T(i,j,k+1) - T(i,j,k-1)) / (2.0*dx[2]);
+                        dP_dr = (P(i,j,k+1) - P(i,j,k-1)) / (2.0*dx[2]);
+                    }
+                    vel = fab(i,j,k,v_comp);
+                    height = (ndims == 2) ? probLo[1] + dx[1] * (Real(j) + 0.5_rt)
+                                          : probLo[2] + dx[2] * (Real(k) + 0.5_rt);
+
+                } else {
+                    // radial derivative and velocity, constructed from the
+                    // Cartesian components
+
+                    Real xpos = probLo[0] + dx[0] * (Real(i) + 0.5_rt) - ctr[0];
+                    Real ypos = probLo[1] + dx[1] * (Real(j) + 0.5_rt) - ctr[1];
+                    Real zpos{0.0};
+                    if (ndims == 3) {
+                        zpos = probLo[2] + dx[2] * (Real(k) + 0.5_rt) - ctr[2];
+                    }
+                    r_zone = std::sqrt(xpos * xpos + ypos * ypos + zpos * zpos);
+
+                    if (r_zone > 0.0_rt) {
+                        dT_dr = (xpos / r_zone) * (T(i+1,j,k) - T(i-1,j,k)) / (2.0*dx[0])
+                              + (ypos / r_zone) * (T(i,j+1,k) - T(i,j-1,k)) / (2.0*dx[1]);
+                        dP_dr = (xpos / r_zone) * (P(i+1,j,k) - P(i-1,j,k)) / (2.0*dx[0])
+                              + (ypos / r_zone) * (P(i,j+1,k) - P(i,j-1,k)) / (2.0*dx[1]);
+                        vel = (xpos * fab(i,j,k,vel_comps[0]) + ypos * fab(i,j,k,vel_comps[1])) / r_zone;
+                        if (ndims == 3) {
+                            dT_dr += (zpos / r_zone) * (T(i,j,k+1) - T(i,j,k-1)) / (2.0*dx[2]);
+                            dP_dr += (zpos / r_zone) * (P(i,j,k+1) - P(i,j,k-1)) / (2.0*dx[2]);
+                            vel += zpos * fab(i,j,k,vel_comps[2]) / r_zone;
+                        }
+                    }
+                    height = r_zone;
+                }
+
+                Real pres = fab(i,j,k,pres_comp);
+                Real rho  = fab(i,j,k,dens_comp);
+                Real temp = fab(i,j,k,temp_comp);
+                Real delT = temp_from_mean ? temp - avg_table.value(mean_T, height)
+                                           : fab(i,j,k,dT_comp);
+
+                if (vel_from_mean) {
+                    vel -= avg_table.value(mean_v, height);
+                }
+
+                Real g = use_grav_table ? grav_table.grav(r_zone) : grav_const;
+
+                // Make EOS
+                eos_t eos_state;
+                eos_state.rho = rho;
+                eos_state.T = temp;
+                for (int n = 0; n < NumSpec; ++n) {
+                    eos_state.xn[n] = fab(i,j,k,spec_comp+n);
+                }
+                eos(eos_input_rt, eos_state);
+
+                conductivity(eos_state);
+
+                // Derive from EOS
+                Real cp = eos_state.cp;
+                Real Q = temp/rho * eos_state.dpdT/eos_state.dpdr; // dlnd/dlnT = T/d dd/dT = T/d (dP/dT)/(dP/dd) = T/d chi_T/chi_d
+
+                // pressure scale height
+                Real Hp = (g > 0.0_rt) ? pres / (rho * g) : 0.0_rt;
+
+                // Convective heat flux
+                ga(i,j,k,0) = rho * cp * vel * delT;
+
+                // Mixing-length heat flux from the measured velocity, using
+                // its absolute value.  With the mixing length equal to Hp, g
+                // cancels: rho cp T |v|**3 / (Q g Hp) = rho**2 cp T |v|**3 / (Q P)
+                ga(i,j,k,1) = pow(rho,2) * cp * temp * pow(std::abs(vel), 3) / (Q * pres);
+
+                // Kinetic flux
+                ga(i,j,k,2) = rho * pow(vel,3);
+
+                // Radiative flux
+                // conductivity is k = 4*a*c*T^3/(kap*rho)
+                // see Microphysics/conductivity/stellar/actual_conductivity.H
+                ga(i,j,k,3) = -eos_state.conductivity * dT_dr;
+
+                // Hydrogen flux
+                ga(i,j,k,4) = rho * vel * fab(i,j,k,spec_comp+0); // this is rho*v*X, not rho*v*dX
+
+                ga(i,j,k,5) = Hp;
+                ga(i,j,k,6) = g;
+
+                // Mixing-length heat flux from the superadiabatic gradient
+                // (Kippenhahn & Weigert Eq. 7.7, with del_e = del_ad), for a
+                // mixing length l = alpha Hp:
+                //   rho cp T sqrt(g Q) l**2 / (4 sqrt(2)) Hp**(-3/2) (del - del_ad)**(3/2)
+                // It is zero where the layer is stable or there is no gravity.
+                Real F_mlt{0.0};
+                if (g > 0.0_rt && dP_dr != 0.0_rt) {
+                    Real del = (dT_dr / dP_dr) * (pres / temp);
+                    Real del_ad = eos_state.dpdT / (eos_state.gam1 * rho * eos_state.cv);
+                    Real sad = del - del_ad;
+                    if (sad > 0.0_rt) {
+                        Real l = mlt_alpha * Hp;
+                        F_mlt = rho * cp * temp * std::sqrt(g * Q) * l * l / (4.0_rt * std::sqrt(2.0_rt)) *
+                            std::pow(Hp, -1.5_rt) * std::pow(sad, 1.5_rt);
+                    }
+                }
+                ga(i,j,k,7) = F_mlt;
+
+                if (tpert_out >= 0) {
+                    ga(i,j,k,tpert_out) = delT;
+                }
+                if (rhopert_out >= 0) {
+                    ga(i,j,k,rhopert_out) = rho - avg_table.value(mean_rho, height);
+                }
+
+            });
+        }
+
+        pool.release(std::move(temp_mf));
+        pool.release(std::move(pres_mf));
+        pool.release(std::move(species_mf));
+        pool.release(std::move(vy_mf));
+        pool.release(std::move(dT_mf));
+        pool.release(std::move(lev_data_mf));
+
+        if (slice) {
+            slice->add_level(ilev, gmf);
+            pool.release(std::move(gmf));
+        } else {
+            writer.write_level(ilev, std::move(gmf));
+        }
+    }
+
+    if (slice) {
+        std::string slicefile = outfile + (slice->isRay() ? "_ray" : "_slice");
+        slice->write(slicefile, gvarnames, pf.time());
+        amrex::Print() << "wrote " << slicefile << std::endl;
+    }
+}
@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include <AMReX.H>
+#include <AMReX_Array.H>
+#include <AMReX_MultiFabUtil.H>
+#include <AMReX_ParallelDescriptor.H>
+#include <AMReX_Print.H>
+#include <AMReX_Vector.H>
+
+#include <extern_parameters.H>
+
+#include <network.H>
+#include <eos.H>
+
+#include <amrex_astro_util.H>
+#include <burn_rates.H>
+#include <compensated_sum.H>
+#include <diag_plotfile.H>
+#include <plotfile_catalog.H>
+
+using namespace amrex;
+
+///
+/// the volume integrals over the zones not covered by a finer level:
+/// the mass, the internal and kinetic energy, the nuclear energy
+/// generation rate, and the mass of each species.
+///
+/// Each box is summed by a single thread in a fixed order with a
+/// compensated sum, the box sums are gathered by box index, and the
+/// boxes and levels are added up in order.  Since the boxes come from
+/// the plotfile, the result doesn't depend on the number of ranks or
+/// threads.  time is set to the time of the plotfile.
+///
+Vector<Real> integrals_plotfile (const std::string& pltfile, int nq, Real& time)
+{
+    DiagPlotFile pf(pltfile, diag_rp::max_level, diag_rp::coarsen);
+    time = pf.time();
+
+    const int ndims = pf.spaceDim();
+    AMREX_ALWAYS_ASSERT(ndims <= AMREX_SPACEDIM);
+
+    const int nlevs = pf.finestLevel() + 1;
+    const int coord = pf.coordSys();
+
+    // only the components that are needed are read: rho, T, X and the
+    // velocities, plus rho e and enuc if the plotfile has them.  Without
+    // them, e comes from the EOS and enuc from the network.
+
+    const Vector<std::string>& var_names_pf = pf.varNames();
+
+    auto find_var = [&] (const Vector<std::string>& names) -> int
+    {
+        for (auto const& name : names) {
+            auto idx = std::find(var_names_pf.cbegin(), var_names_pf.cend(), name);
+            if (idx != var_names_pf.cend()) {
+                return static_cast<int>(std::distance(var_names_pf.cbegin(), idx));
+            }
+        }
+        return -1;
+    };
+
+    Vector<int> read_comps{get_dens_index(var_names_pf), get_temp_index(var_names_pf)};
+    const int spec_comp = get_spec_index(var_names_pf);
+    for (int n = 0; n < NumSpec; ++n) {
+        read_comps.push_back(spec_comp + n);
+    }
+    const int vel_n = static_cast<int>(read_comps.size());
+    read_comps.push_back(get_vx_index(var_names_pf));
+    if (ndims >= 2) {
+        read_comps.push_back(get_vy_index(var_names_pf));
+    }
+    if (ndims == 3) {
+        read_comps.push_back(get_vz_index(var_names_pf));
+    }
+
+    int rhoe_n{-1};
+    const int rhoe_comp = find_var({"rho_e", "rhoe"});
+    if (rhoe_comp >= 0) {
+        rhoe_n = static_cast<int>(read_comps.size());
+        read_comps.push_back(rhoe_comp);
+    }
+
+    int enuc_n{-1};
+    const int enuc_comp = find_var({"enuc"});
+    if (enuc_comp >= 0) {
+        enuc_n = static_cast<int>(read_comps.size());
+        read_comps.push_back(enuc_comp);
+    }
+
+    const int ncomp = static_cast<int>(read_comps.size());
+
+    auto const probLo = pf.probLo();
+    Vector<Real> center(AMREX_SPACEDIM, 0.0_rt);
+
+    Vector<CompensatedSum> total(nq);
+
+    for (int ilev = 0; ilev < nlevs; ++ilev) {
+
+        MultiFab state(pf.boxArray(ilev), pf.DistributionMap(ilev), ncomp, 0);
+        for (int c = 0; c < ncomp; ++c) {
+            MultiFab mf = pf.get(ilev, var_names_pf[read_comps[c]]);
+            MultiFab::Copy(state, mf, 0, c, 1, 0);
+            pf.release(std::move(mf));
+        }
+
+        iMultiFab mask(pf.boxArray(ilev), pf.DistributionMap(ilev), 1, 0);
+        if (ilev < nlevs-1) {
+            IntVect ratio{pf.refRatio(ilev)};
+            for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+                ratio[idim] = 1;
+            }
+            mask = makeFineMask(pf.boxArray(ilev), pf.DistributionMap(ilev),
+                                pf.boxArray(ilev+1), ratio);
+        } else {
+            mask.setVal(0);
+        }
+
+        auto const dx = pf.cellSize(ilev);
+        const int nboxes = static_cast<int>(pf.boxArray(ilev).size());
+
+        // the sums of each box, indexed by box.  Every entry is only set
+        // by the rank that owns the box, so the MPI sum below is exact.
+
+        Vector<Real> box_sums(static_cast<std::size_t>(nboxes) * nq, 0.0_rt);
+
+        // no tiling, so each box is done by one thread in order
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel
+#endif
+        for (MFIter mfi(state); mfi.isValid(); ++mfi) {
+            const Box& bx = mfi.validbox();
+            auto const& fab = state.const_array(mfi);
+            auto const& m = mask.const_array(mfi);
+            const auto lo = amrex::lbound(bx);
+            const auto hi = amrex::ubound(bx);
+
+            Vector<CompensatedSum> sums(nq);
+
+            for (int k = lo.z; k <= hi.z; ++k) {
+                for (int j = lo.y; j <= hi.y; ++j) {
+                    for (int i = lo.x; i <= hi.x; ++i) {
+                        if (m(i,j,k) == 1) {
+                            continue;
+                        }
+
+                        Array<Real, AMREX_SPACEDIM> p = {AMREX_D_DECL(probLo[0] + (static_cast<Real>(i) + 0.5_rt) * dx[0],
+                                                                      probLo[1] + (static_cast<Real>(j) + 0.5_rt) * dx[1],
+                                                                      probLo[2] + (static_cast<Real>(k) + 0.5_rt) * dx[2])};
+
+                        const Real vol = get_coord_info(p, center, dx, coord, coord == 1).second;
+
+                        const Real rho = fab(i,j,k,0);
+                        const Real T = fab(i,j,k,1);
+
+                        Real X[NumSpec];
+                        for (int n = 0; n < NumSpec; ++n) {
+                            X[n] = fab(i,j,k,2+n);
+                        }
+
+                        Real rhoe{0.0_rt};
+                        if (rhoe_n >= 0) {
+                            rhoe = fab(i,j,k,rhoe_n);
+                        } else {
+                            eos_t eos_state;
+                            eos_state.rho = rho;
+                            eos_state.T = T;
+                            for (int n = 0; n < NumSpec; ++n) {
+                                eos_state.xn[n] = X[n];
+                            }
+                            eos(eos_input_rt, eos_state);
+                            rhoe = rho * eos_state.e;
+                        }
+
+                        Real vel2{0.0_rt};
+                        for (int idim = 0; idim < ndims; ++idim) {
+                            vel2 += fab(i,j,k,vel_n+idim) * fab(i,j,k,vel_n+idim);
+                        }
+
+                        const Real enuc = (enuc_n >= 0) ? fab(i,j,k,enuc_n) : burn_rates(rho, T, X, nullptr);
+
+                        sums[0].add(rho * vol);
+                        sums[1].add(rhoe * vol);
+                        sums[2].add(0.5_rt * rho * vel2 * vol);
+                        sums[3].add(rho * enuc * vol);
+                        for (int n = 0; n < NumSpec; ++n) {
+                            sums[4+n].add(rho * X[n] * vol);
+                        }
+                    }
+                }
+            }
+
+            for (int q = 0; q < nq; ++q) {
+                box_sums[static_cast<std::size_t>(mfi.index()) * nq + q] = sums[q].value();
+            }
+        }
+
+        ParallelDescriptor::ReduceRealSum(box_sums.data(), static_cast<int>(box_sums.size()));
+
+        for (int b = 0; b < nboxes; ++b) {
+            for (int q = 0; q < nq; ++q) {
+                total[q].add(box_sums[static_cast<std::size_t>(b) * nq + q]);
+            }
+        }
+    }
+
+    Vector<Real> result(nq);
+    for (int q = 0; q < nq; ++q) {
+        result[q] = total[q].value();
+    }
+    return result;
+}
+
+void main_main()
+{
+
+    auto pltfiles = select_plotfiles(diag_rp::plotfile, diag_rp::catalog, diag_rp::query);
+
+    Vector<std::string> names{"mass", "E_int", "E_kin", "L_nuc"};
+    for (int n = 0; n < NumSpec; ++n) {
+        names.push_back("M(" + short_spec_names_cxx[n] + ")");
+    }
+    const int nq = static_cast<int>(names.size());
+
+    // one line per plotfile, at full precision so runs can be compared
+    // exactly
+
+    std::ofstream of;
+    if (ParallelDescriptor::IOProcessor()) {
+        of.open(diag_rp::outfile);
+        if (!of.is_open()) {
+            amrex::Error("integrals: unable to open " + diag_rp::outfile);
+        }
+        of << "# " << std::setw(22) << "plotfile" << std::setw(25) << "time";
+        for (auto const& name : names) {
+            of << std::setw(25) << name;
+        }
+        of << std::endl;
+    }
+
+    for (auto const& pltfile : pltfiles) {
+        amrex::Print() << "processing " << pltfile << std::endl;
+
+        Real time{0.0_rt};
+        auto result = integrals_plotfile(pltfile, nq, time);
+
+        for (int q = 0; q < nq; ++q) {
+            amrex::Print() << "  " << std::setw(12) << std::left << names[q] << std::right
+                           << " = " << std::setprecision(12) << result[q] << std::endl;
+        }
+
+        if (ParallelDescriptor::IOProcessor()) {
+            of << "  " << std::setw(22) << pltfile
+               << std::setprecision(17) << std::setw(25) << time;
+            for (auto r : result) {
+                of << std::setw(25) << r;
+            }
+            of << std::endl;
+        }
+    }
+
+    amrex::Print() << "wrote " << diag_rp::outfile << std::endl;
+}
+
+int main (int argc, char* argv[])
+{
+    amrex::Initialize(argc, argv);
+
+    // initialize the runtime parameters
+
+    init_extern_parameters();
+
+    // initialize C++ Microphysics
+
+    eos_init(diag_rp::small_temp, diag_rp::small_dens);
+    network_init();
+
+    main_main();
+
+    amrex::Finalize();
+}
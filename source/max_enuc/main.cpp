@@ -1,13 +1,17 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+
 #include <AMReX.H>
-#include <AMReX_Print.H>
-#include <AMReX_PlotFileUtil.H>
-#include <AMReX_MultiFabUtil.H>
 #include <AMReX_ParallelDescriptor.H>
-#include <limits>
-#include <fstream>
-#include <cmath>
-#include <iterator>
-#include <algorithm>
+#include <AMReX_Print.H>
+
+#include <extern_parameters.H>
+
+#include <network.H>
+#include <eos.H>
+
+#include <max_enuc.H>
 
 // find the thermodynamic state corresponding to the larged abs(enuc)
 // and output it
@@ -18,9 +22,6 @@ void main_main()
 {
     const int narg = amrex::command_argument_count();
 
-    std::string pltfile;
-    std::string varname_arg;
-
     // the executable name is the first arg
 
     int farg{1};
@@ -39,51 +40,19 @@ void main_main()
 
     const std::string& filename = amrex::get_command_argument(farg);
 
-    PlotFileData pf(filename);
-
-    const Vector<std::string>& var_names_pf = pf.varNames();
-
-    // we need rho, T, X, and enuc
-
-    auto ienuc = static_cast<int>(std::distance(var_names_pf.cbegin(), std::find(var_names_pf.cbegin(), var_names_pf.cend(), "enuc")));
+    auto result = find_max_enuc(filename);
 
-    int fine_level = pf.finestLevel();
-
-    Vector<Real> lstate(var_names_pf.size(), 0.0);
-
-    int level = fine_level;
-
-    Real enuc_max = std::numeric_limits<Real>::lowest();
-
-    const MultiFab& mf = pf.get(level);
-    for (MFIter mfi(mf); mfi.isValid(); ++mfi) {
-        const Box& bx = mfi.validbox();
-        if (bx.ok()) {
-            const auto& fab = mf.array(mfi);
-            const auto lo = amrex::lbound(bx);
-            const auto hi = amrex::ubound(bx);
-            for (int k = lo.z; k <= hi.z; ++k) {
-                for (int j = lo.y; j <= hi.y; ++j) {
-                    for (int i = lo.x; i <= hi.x; ++i) {
-                        if (std::abs(fab(i,j,k,ienuc)) > enuc_max) {
-                            enuc_max = std::abs(fab(i,j,k,ienuc));
-                            for (int ivar = 0; ivar < var_names_pf.size(); ++ivar) {
-                                lstate[ivar] = fab(i,j,k,ivar);
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    if (!ParallelDescriptor::IOProcessor()) {
+        return;
     }
 
-    std::cout << "enuc_max = " << enuc_max << std::endl;
-
-    //ParallelDescriptor::ReduceRealSum(lstate.data(), lstate.size());
+    std::cout << "enuc_max = " << result.enuc_max
+              << " (read " << result.nfabs_read << " of " << result.nfabs << " FABs, "
+              << result.nfabs_in_place << " of them in place)" << std::endl;
 
     // output the header
-    for (int ivar = 0; ivar < var_names_pf.size(); ++ivar) {
-        std::cout << std::setw(25) << std::left << var_names_pf[ivar] << std::setw(25) << lstate[ivar] << std::endl;
+    for (int ivar = 0; ivar < result.varnames.size(); ++ivar) {
+        std::cout << std::setw(25) << std::left << result.varnames[ivar] << std::setw(25) << result.state[ivar] << std::endl;
     }
     std::cout << std::endl;
 
@@ -93,6 +62,15 @@ int main (int argc, char* argv[])
 {
     amrex::SetVerbose(0);
     amrex::Initialize(argc, argv, false);
+
+    // initialize the runtime parameters and C++ Microphysics, since
+    // enuc is evaluated from the network if the plotfile lacks it
+
+    init_extern_parameters();
+
+    eos_init(diag_rp::small_temp, diag_rp::small_dens);
+    network_init();
+
     main_main();
     amrex::Finalize();
 }
@@ -0,0 +1,194 @@
+#include <AMReX.H>
+#include <AMReX_Print.H>
+#include <AMReX_PlotFileUtil.H>
+#include <AMReX_MultiFabUtil.H>
+#include <AMReX_ParallelDescriptor.H>
+#include <limits>
+#include <fstream>
+#include <cmath>
+#include <iterator>
+#include <algorithm>
+#include <numeric>
+
+#include <extern_parameters.H>
+
+#include <network.H>
+
+#include <amrex_astro_util.H>
+#include <burn_rates.H>
+#include <plotfile_mmap.H>
+
+#include <max_enuc.H>
+
+using namespace amrex;
+
+MaxEnucState find_max_enuc (const std::string& filename)
+{
+    // the data is only scanned, so we map the FABs rather than reading
+    // them into a MultiFab
+
+    MappedPlotfile pf(filename);
+
+    const Vector<std::string>& var_names_pf = pf.varNames();
+
+    // we need enuc, or rho, T, and X to evaluate it from the network
+
+    auto enuc_it = std::find(var_names_pf.cbegin(), var_names_pf.cend(), "enuc");
+    const bool have_enuc = enuc_it != var_names_pf.cend();
+    const auto ienuc = static_cast<int>(std::distance(var_names_pf.cbegin(), enuc_it));
+
+    int dens_comp{-1};
+    int temp_comp{-1};
+    int spec_comp{-1};
+    if (!have_enuc) {
+        dens_comp = get_dens_index(var_names_pf);
+        temp_comp = get_temp_index(var_names_pf);
+        spec_comp = get_spec_index(var_names_pf);
+    }
+
+    int fine_level = pf.finestLevel();
+
+    // the state is the plotfile variables, followed by the evaluated
+    // enuc if the plotfile doesn't have it
+
+    const int nvars = static_cast<int>(var_names_pf.size());
+    Vector<Real> lstate(nvars + (have_enuc ? 0 : 1), 0.0);
+
+    int level = fine_level;
+
+    Real enuc_max = std::numeric_limits<Real>::lowest();
+
+    Long nread{0};
+
+    // scan one FAB, keeping the zone with the largest |enuc| so far, and
+    // return the largest |enuc| in the FAB
+
+    auto scan_fab = [&] (int ifab) -> Real
+    {
+        Real fab_max{0.0};
+        const FabView fab_view = pf.fab(level, ifab);
+        const Box& bx = fab_view.box();
+        if (bx.ok()) {
+            const auto& fab = fab_view.const_array();
+            const auto lo = amrex::lbound(bx);
+            const auto hi = amrex::ubound(bx);
+            for (int k = lo.z; k <= hi.z; ++k) {
+                for (int j = lo.y; j <= hi.y; ++j) {
+                    for (int i = lo.x; i <= hi.x; ++i) {
+                        Real enuc{0.0};
+                        if (have_enuc) {
+                            enuc = fab(i,j,k,ienuc);
+                        } else {
+                            Real X[NumSpec];
+                            for (int n = 0; n < NumSpec; ++n) {
+                                X[n] = fab(i,j,k,spec_comp+n);
+                            }
+                            enuc = burn_rates(fab(i,j,k,dens_comp), fab(i,j,k,temp_comp), X, nullptr);
+                        }
+                        fab_max = std::max(fab_max, std::abs(enuc));
+                        if (std::abs(enuc) > enuc_max) {
+                            enuc_max = std::abs(enuc);
+                            for (int ivar = 0; ivar < nvars; ++ivar) {
+                                lstate[ivar] = fab(i,j,k,ivar);
+                            }
+                            if (!have_enuc) {
+                                lstate[nvars] = enuc;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        ++nread;
+        return fab_max;
+    };
+
+    const int nprocs = ParallelDescriptor::NProcs();
+    const int myproc = ParallelDescriptor::MyProc();
+    const int nfabs = pf.nFabs(level);
+
+    // if the plotfile stores enuc, the min and max of each FAB in the
+    // Cell_H file give its largest |enuc| without reading it.  The
+    // largest of these is the answer (up to the precision of the
+    // header), so only the FABs within minmax_slack of it are read, in
+    // order of their bounds, and a FAB is skipped once it can't beat
+    // what has been found.  If the data doesn't match the header, every
+    // FAB is read after all.
+
+    const Real slack = diag_rp::minmax_slack;
+    Vector<Real> bounds;
+    if (have_enuc && diag_rp::use_minmax) {
+        bounds = fab_abs_max(pf.cellHeader(level), ienuc);
+    }
+
+    bool pruned = !bounds.empty() && nfabs > 0;
+
+    if (pruned) {
+        Vector<int> order(nfabs);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+                         [&] (int a, int b) { return bounds[a] > bounds[b]; });
+
+        const Real top = bounds[order[0]];
+        Vector<int> candidates;
+        for (int ifab : order) {
+            if (bounds[ifab] * (1.0_rt + slack) < top * (1.0_rt - slack) ||
+                (top == 0.0_rt && !candidates.empty())) {
+                break;
+            }
+            candidates.push_back(ifab);
+        }
+
+        int mismatch{0};
+        for (int n = myproc; n < static_cast<int>(candidates.size()); n += nprocs) {
+            const int ifab = candidates[n];
+            if (bounds[ifab] * (1.0_rt + slack) < enuc_max) {
+                break;
+            }
+            const Real fab_max = scan_fab(ifab);
+            if (std::abs(fab_max - bounds[ifab]) > slack * bounds[ifab]) {
+                mismatch = 1;
+            }
+        }
+
+        ParallelDescriptor::ReduceIntMax(mismatch);
+        if (mismatch != 0) {
+            amrex::Print() << "max_enuc: the min/max of enuc in the Cell_H file don't match the data, "
+                           << "reading every FAB" << std::endl;
+            pruned = false;
+            enuc_max = std::numeric_limits<Real>::lowest();
+        }
+    }
+
+    // otherwise the FABs are dealt out to the ranks in turn
+
+    if (!pruned) {
+        for (int ifab = myproc; ifab < nfabs; ifab += nprocs) {
+            scan_fab(ifab);
+        }
+    }
+
+    ParallelDescriptor::ReduceLongSum(nread);
+    Long nin_place = pf.nZeroCopy();
+    ParallelDescriptor::ReduceLongSum(nin_place);
+
+    // the state comes from the lowest rank that has the global maximum
+
+    Real local_max = enuc_max;
+    ParallelDescriptor::ReduceRealMax(enuc_max);
+    int owner = (local_max == enuc_max) ? myproc : nprocs;
+    ParallelDescriptor::ReduceIntMin(owner);
+    ParallelDescriptor::Bcast(lstate.data(), lstate.size(), owner);
+
+    MaxEnucState result;
+    result.enuc_max = enuc_max;
+    result.varnames = var_names_pf;
+    if (!have_enuc) {
+        result.varnames.emplace_back("enuc");
+    }
+    result.state = lstate;
+    result.nfabs = nfabs;
+    result.nfabs_read = nread;
+    result.nfabs_in_place = nin_place;
+    return result;
+}
@@ -0,0 +1,303 @@
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <AMReX.H>
+#include <AMReX_MultiFab.H>
+#include <AMReX_ParmParse.H>
+#include <AMReX_Vector.H>
+
+#include <extern_parameters.H>
+
+#include <network.H>
+#include <eos.H>
+
+#include <multifab_pool.H>
+#include <plotfile_writer.H>
+
+#include <convgrad_process.H>
+#include <fluxes_process.H>
+#include <max_enuc.H>
+
+#if defined(AMREX_USE_GPU) || defined(AMREX_USE_MPI)
+#error "the Python bindings need a serial CPU build, since the arrays view host memory"
+#endif
+
+namespace py = pybind11;
+
+using namespace amrex;
+
+namespace {
+
+///
+/// the derived fields of one plotfile.  The NumPy arrays handed to
+/// Python point straight into the FABs, and every array holds a
+/// reference to this, so the MultiFabs live as long as any of them.
+///
+struct CapturedFields
+{
+    Vector<MultiFab> levels;
+};
+
+///
+/// AMReX can only be finalized once no array views its memory.  The
+/// counters are only touched with the GIL held.
+///
+int live_fields = 0;
+bool finalize_pending = false;
+
+void release_fields (void* p)
+{
+    delete static_cast<std::shared_ptr<CapturedFields>*>(p);
+    if (--live_fields == 0 && finalize_pending) {
+        amrex::Finalize();
+    }
+}
+
+///
+/// at exit, finalize AMReX now if nothing views its memory, otherwise
+/// when the last array is freed (arrays still alive at the very end of
+/// the interpreter leave it to the OS)
+///
+void finalize_at_exit ()
+{
+    if (live_fields == 0) {
+        amrex::Finalize();
+    } else {
+        finalize_pending = true;
+    }
+}
+
+///
+/// the names of the diag.* parameters, generated by the GNUmakefile
+/// from the _parameters of the tools
+///
+const std::set<std::string>& diag_parameters ()
+{
+    static const std::set<std::string> names{
+#include <diag_parameter_names.H>
+    };
+    return names;
+}
+
+///
+/// set diag.* runtime parameters from keyword arguments for the
+/// duration of one call.  Names that aren't diag.* parameters raise a
+/// TypeError, as for any unexpected keyword.
+///
+class ScopedParameters
+{
+public:
+
+    explicit ScopedParameters (const py::kwargs& kwargs)
+    {
+        ParmParse pp("diag");
+        for (auto const& item : kwargs) {
+            auto name = py::cast<std::string>(item.first);
+            if (diag_parameters().count(name) == 0) {
+                remove_added();
+                throw py::type_error("unexpected keyword argument '" + name +
+                                     "': not a diag.* parameter");
+            }
+            const py::handle value = item.second;
+            if (py::isinstance<py::bool_>(value) || py::isinstance<py::int_>(value)) {
+                pp.add(name.c_str(), py::cast<int>(value));
+            } else if (py::isinstance<py::float_>(value)) {
+                pp.add(name.c_str(), py::cast<Real>(value));
+            } else if (py::isinstance<py::str>(value)) {
+                pp.add(name.c_str(), py::cast<std::string>(value));
+            } else {
+                remove_added();
+                throw py::type_error("diag." + name + " must be a bool, int, float or str");
+            }
+            m_names.push_back(name);
+        }
+        init_extern_parameters();
+    }
+
+    ScopedParameters (const ScopedParameters&) = delete;
+    ScopedParameters (ScopedParameters&&) = delete;
+    ScopedParameters& operator= (const ScopedParameters&) = delete;
+    ScopedParameters& operator= (ScopedParameters&&) = delete;
+
+    ~ScopedParameters ()
+    {
+        // back to the defaults
+        remove_added();
+        init_extern_parameters();
+    }
+
+private:
+
+    void remove_added ()
+    {
+        ParmParse pp("diag");
+        for (auto const& name : m_names) {
+            pp.remove(name);
+        }
+    }
+
+    std::vector<std::string> m_names;
+};
+
+template <typename T>
+py::tuple to_tuple (const T& a, int n)
+{
+    py::tuple t(n);
+    for (int i = 0; i < n; ++i) {
+        t[i] = a[i];
+    }
+    return t;
+}
+
+///
+/// hand the levels captured by writer to Python.  Each box becomes a
+/// NumPy array of shape (ncomp, [nz,] [ny,] nx) -- AMReX stores x
+/// fastest, then y, z and the component -- that views the FAB.
+///
+py::dict to_python (PlotfileWriter& writer)
+{
+    auto fields = std::make_shared<CapturedFields>();
+    fields->levels = std::move(writer.levels());
+
+    // one capsule owns a reference to the fields, and is the base of
+    // every array
+    py::capsule base(new std::shared_ptr<CapturedFields>(fields), release_fields);
+    ++live_fields;
+
+    py::list levels;
+    for (int ilev = 0; ilev < static_cast<int>(fields->levels.size()); ++ilev) {
+        MultiFab& mf = fields->levels[ilev];
+        const Geometry& geom = writer.geometry()[ilev];
+
+        py::list boxes;
+        for (MFIter mfi(mf); mfi.isValid(); ++mfi) {
+            FArrayBox& fab = mf[mfi];
+            const Box& bx = fab.box();
+
+            std::vector<py::ssize_t> shape{fab.nComp()};
+            std::vector<py::ssize_t> strides{static_cast<py::ssize_t>(bx.numPts() * sizeof(Real))};
+            for (int idim = AMREX_SPACEDIM-1; idim >= 0; --idim) {
+                auto stride = static_cast<py::ssize_t>(sizeof(Real));
+                for (int d = 0; d < idim; ++d) {
+                    stride *= bx.length(d);
+                }
+                shape.push_back(bx.length(idim));
+                strides.push_back(stride);
+            }
+
+            py::dict b;
+            b["lo"] = to_tuple(bx.smallEnd(), AMREX_SPACEDIM);
+            b["hi"] = to_tuple(bx.bigEnd(), AMREX_SPACEDIM);
+            b["data"] = py::array_t<Real>(shape, strides, fab.dataPtr(), base);
+            boxes.append(b);
+        }
+
+        py::dict level;
+        level["dx"] = to_tuple(geom.CellSize(), AMREX_SPACEDIM);
+        level["boxes"] = boxes;
+        levels.append(level);
+    }
+
+    py::dict result;
+    result["plotfile"] = writer.plotfileName();
+    result["time"] = writer.time();
+    result["varnames"] = std::vector<std::string>(writer.varNames().begin(), writer.varNames().end());
+    if (!writer.geometry().empty()) {
+        result["prob_lo"] = to_tuple(writer.geometry()[0].ProbLo(), AMREX_SPACEDIM);
+        result["prob_hi"] = to_tuple(writer.geometry()[0].ProbHi(), AMREX_SPACEDIM);
+    }
+    result["levels"] = levels;
+    return result;
+}
+
+py::dict convective_grad (const std::string& plotfile, const py::kwargs& kwargs)
+{
+    ScopedParameters params(kwargs);
+    MultiFabPool pool(diag_rp::use_pool);
+    PlotfileWriter writer(PlotfileWriter::Capture{});
+    {
+        py::gil_scoped_release release;
+        convective_grad_plotfile(plotfile, writer, pool);
+    }
+    return to_python(writer);
+}
+
+py::dict fluxes (const std::string& plotfile, const py::kwargs& kwargs)
+{
+    ScopedParameters params(kwargs);
+    MultiFabPool pool(diag_rp::use_pool);
+    PlotfileWriter writer(PlotfileWriter::Capture{});
+    {
+        py::gil_scoped_release release;
+        fluxes_plotfile(plotfile, writer, pool);
+    }
+    return to_python(writer);
+}
+
+py::dict max_enuc (const std::string& plotfile)
+{
+    MaxEnucState s;
+    {
+        py::gil_scoped_release release;
+        s = find_max_enuc(plotfile);
+    }
+
+    py::dict state;
+    for (int n = 0; n < static_cast<int>(s.varnames.size()); ++n) {
+        state[py::str(s.varnames[n])] = s.state[n];
+    }
+
+    py::dict result;
+    result["enuc_max"] = s.enuc_max;
+    result["state"] = state;
+    return result;
+}
+
+}
+
+PYBIND11_MODULE(amrex_astro_diag, m)
+{
+    m.doc() = "derived fields of AMReX astrophysics plotfiles, returned as NumPy views";
+
+    // AMReX and the microphysics are set up once, when the module is
+    // imported.  AMReX errors become Python exceptions, and Python keeps
+    // its own signal handlers.
+
+    if (!amrex::Initialized()) {
+        static char name[] = "amrex_astro_diag";
+        static char signals[] = "amrex.signal_handling=0";
+        static char exceptions[] = "amrex.throw_exception=1";
+        static char* args[] = {name, signals, exceptions, nullptr};
+        int argc = 3;
+        char** argv = args;
+
+        amrex::SetVerbose(0);
+        amrex::Initialize(argc, argv);
+
+        init_extern_parameters();
+
+        eos_init(diag_rp::small_temp, diag_rp::small_dens);
+        network_init();
+
+        py::module_::import("atexit").attr("register")(py::cpp_function(finalize_at_exit));
+    }
+
+    m.def("convective_grad", &convective_grad, py::arg("plotfile"),
+          "del, del_ad and del_ledoux on every box of every level.  Keyword\n"
+          "arguments set the diag.* runtime parameters for this call.");
+
+    m.def("fluxes", &fluxes, py::arg("plotfile"),
+          "the convective, kinetic, radiative and composition fluxes on every\n"
+          "box of every level.  Keyword arguments set the diag.* runtime\n"
+          "parameters for this call.");
+
+    m.def("max_enuc", &max_enuc, py::arg("plotfile"),
+          "the largest |enuc| on the finest level, and the state there");
+}
@@ -0,0 +1,392 @@
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <AMReX.H>
+#include <AMReX_Array.H>
+#include <AMReX_FillPatchUtil.H>
+#include <AMReX_GpuDevice.H>
+#include <AMReX_ParallelDescriptor.H>
+#include <AMReX_Print.H>
+#include <AMReX_Vector.H>
+
+#include <extern_parameters.H>
+
+#include <network.H>
+#include <eos.H>
+
+#include <amrex_astro_util.H>
+#include <diag_plotfile.H>
+#include <plotfile_catalog.H>
+
+#include <fft.H>
+
+using namespace amrex;
+
+///
+/// horizontal power spectra of the velocity and temperature
+/// fluctuations of one plotfile, for every selected height
+///
+void spectra_plotfile (const std::string& pltfile)
+{
+
+    std::string outfile = "spectra." +
+        std::filesystem::path(pltfile).filename().string();
+
+    DiagPlotFile pf(pltfile, diag_rp::max_level, diag_rp::coarsen);
+
+    const int ndims = pf.spaceDim();
+    AMREX_ALWAYS_ASSERT(ndims <= AMREX_SPACEDIM);
+
+    if (ndims < 2) {
+        amrex::Error("spectra: the plotfile needs at least one horizontal direction");
+    }
+    if (pf.coordSys() != 0) {
+        amrex::Error("spectra: only Cartesian plotfiles are supported");
+    }
+
+    const int vdir = ndims - 1;
+    const int fine_level = pf.finestLevel();
+
+    // the fields: the velocity components, the temperature, and the
+    // density if the velocities are weighted by sqrt(rho)
+
+    const Vector<std::string>& var_names_pf = pf.varNames();
+
+    const bool weighted = diag_rp::density_weighted;
+    const char* vel_names[] = {"velx", "vely", "velz"};
+
+    Vector<std::string> fields;
+    for (int idim = 0; idim < ndims; ++idim) {
+        fields.emplace_back(vel_names[idim]);
+        if (std::find(var_names_pf.cbegin(), var_names_pf.cend(), fields.back()) == var_names_pf.cend()) {
+            amrex::Error("spectra: could not find " + fields.back());
+        }
+    }
+    const int temp_n = static_cast<int>(fields.size());
+    fields.push_back(var_names_pf[get_temp_index(var_names_pf)]);
+    const int dens_n = static_cast<int>(fields.size());
+    if (weighted) {
+        fields.push_back(var_names_pf[get_dens_index(var_names_pf)]);
+    }
+    const int ncomp = static_cast<int>(fields.size());
+
+    // the horizontal directions are periodic, the vertical one is
+    // extrapolated
+
+    Vector<BCRec> bcr(ncomp);
+    Array<int,AMREX_SPACEDIM> is_periodic{AMREX_D_DECL(1,1,1)};
+    is_periodic[vdir] = 0;
+    for (auto& bc : bcr) {
+        for (int idim = 0; idim < AMREX_SPACEDIM; ++idim) {
+            if (idim == vdir) {
+                bc.setLo(idim, BCType::hoextrapcc);
+                bc.setHi(idim, BCType::hoextrapcc);
+            } else {
+                bc.setLo(idim, BCType::int_dir);
+                bc.setHi(idim, BCType::int_dir);
+            }
+        }
+    }
+
+    Vector<Geometry> geom;
+    for (int ilev = 0; ilev <= fine_level; ++ilev) {
+        geom.emplace_back(pf.probDomain(ilev), RealBox(pf.probLo(),pf.probHi()),
+                          pf.coordSys(), is_periodic);
+    }
+
+    // build the fields on the whole finest level, with every rank
+    // holding a slab of complete horizontal planes, so the transforms
+    // don't need any communication.  Each level is interpolated from
+    // the one below and then overwritten by its own data where it has
+    // some.
+
+    auto slabs = [&] (int ilev)
+    {
+        const Box& domain = pf.probDomain(ilev);
+        const int nplanes = domain.length(vdir);
+        const int nslabs = amrex::min(ParallelDescriptor::NProcs(), nplanes);
+        IntVect max_size = domain.length();
+        max_size[vdir] = (nplanes + nslabs - 1) / nslabs;
+        BoxArray ba(domain);
+        ba.maxSize(max_size);
+        return ba;
+    };
+
+    MultiFab uniform;
+
+    for (int ilev = 0; ilev <= fine_level; ++ilev) {
+
+        BoxArray ba = slabs(ilev);
+        DistributionMapping dm(ba);
+        MultiFab lev_mf(ba, dm, ncomp, 0);
+
+        if (ilev > 0) {
+            auto* mapper = (Interpolater*)(&cell_cons_interp);
+
+            IntVect ratio(pf.refRatio(ilev-1));
+            for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+                ratio[idim] = 1;
+            }
+
+            PhysBCFunct<GpuBndryFuncFab<FabFillNoOp>> cphysbcf
+                (geom[ilev-1], bcr, GpuBndryFuncFab<FabFillNoOp>(FabFillNoOp{}));
+            PhysBCFunct<GpuBndryFuncFab<FabFillNoOp>> fphysbcf
+                (geom[ilev], bcr, GpuBndryFuncFab<FabFillNoOp>(FabFillNoOp{}));
+
+            InterpFromCoarseLevel(lev_mf, Real(0.0), uniform, 0, 0, ncomp,
+                                  geom[ilev-1], geom[ilev], cphysbcf, 0, fphysbcf, 0,
+                                  ratio, mapper, bcr, 0);
+        }
+
+        for (int n = 0; n < ncomp; ++n) {
+            MultiFab smf = pf.get(ilev, fields[n]);
+            lev_mf.ParallelCopy(smf, 0, n, 1);
+        }
+
+        uniform = std::move(lev_mf);
+    }
+
+    // the heights we want, as plane indices on the finest level
+
+    const Box& domain = pf.probDomain(fine_level);
+    auto const probLo = pf.probLo();
+    auto const dx = pf.cellSize(fine_level);
+
+    const int k0 = domain.smallEnd(vdir);
+    const int nplanes = domain.length(vdir);
+
+    Vector<int> planes;
+    if (diag_rp::heights.empty()) {
+        for (int k = 0; k < nplanes; ++k) {
+            planes.push_back(k0 + k);
+        }
+    } else {
+        std::istringstream iss(diag_rp::heights);
+        Real h{};
+        while (iss >> h) {
+            int k = static_cast<int>(std::floor((h - probLo[vdir]) / dx[vdir]));
+            planes.push_back(amrex::max(domain.smallEnd(vdir), amrex::min(k, domain.bigEnd(vdir))));
+        }
+        if (!iss.eof()) {
+            amrex::Error("spectra: can't parse heights = " + diag_rp::heights);
+        }
+        std::sort(planes.begin(), planes.end());
+        planes.erase(std::unique(planes.begin(), planes.end()), planes.end());
+    }
+
+    // where each plane goes in the output (-1 if not wanted)
+
+    Vector<int> plane_out(nplanes, -1);
+    for (int p = 0; p < static_cast<int>(planes.size()); ++p) {
+        plane_out[planes[p] - k0] = p;
+    }
+
+    // the wavenumber shells.  The shell width is the fundamental mode
+    // of the longest horizontal direction.
+
+    const int nx = domain.length(0);
+    const int ny = (ndims == 3) ? domain.length(1) : 1;
+    const Real Lx = static_cast<Real>(nx) * dx[0];
+    const Real Ly = (ndims == 3) ? static_cast<Real>(ny) * dx[1] : 0.0_rt;
+    const Real dk = 2.0_rt * M_PI / amrex::max(Lx, Ly);
+
+    auto wavenumber = [] (int i, int n, Real L)
+    {
+        const int m = (i <= n/2) ? i : i - n;
+        return 2.0_rt * M_PI * static_cast<Real>(m) / L;
+    };
+
+    // the transforms only store kx >= 0.  Every other mode stands for
+    // itself and its conjugate at (-kx, -ky), which is in the same
+    // shell, so it counts twice.
+
+    const RealFFT fft(nx, ny);
+    const int nxh = fft.nxHalf();
+
+    const auto npts = static_cast<std::size_t>(nx) * ny;
+    const auto nmodes = static_cast<std::size_t>(nxh) * ny;
+    Vector<int> shell(nmodes);
+    Vector<Real> multiplicity(nmodes);
+    int nshells{0};
+    for (int j = 0; j < ny; ++j) {
+        const Real ky = (ndims == 3) ? wavenumber(j, ny, Ly) : 0.0_rt;
+        for (int i = 0; i < nxh; ++i) {
+            const Real kx = wavenumber(i, nx, Lx);
+            const int s = static_cast<int>(std::lround(std::sqrt(kx * kx + ky * ky) / dk));
+            const auto idx = static_cast<std::size_t>(j) * nxh + i;
+            shell[idx] = s;
+            multiplicity[idx] = (i == 0 || 2 * i == nx) ? 1.0_rt : 2.0_rt;
+            nshells = amrex::max(nshells, s + 1);
+        }
+    }
+
+    // the spectra: for each plane, the kinetic energy (total, horizontal
+    // and vertical) and the temperature fluctuation, in each shell
+
+    const Vector<std::string> qnames{"ekin", "ekin_h", "ekin_v", "tpert"};
+    const int nq = static_cast<int>(qnames.size());
+
+    Vector<Real> spec(planes.size() * nq * nshells, 0.0_rt);
+
+    const Real norm = 1.0_rt / static_cast<Real>(npts);
+
+    for (MFIter mfi(uniform); mfi.isValid(); ++mfi) {
+        const Box& bx = mfi.validbox();
+
+        FArrayBox host(bx, ncomp, The_Pinned_Arena());
+        Gpu::dtoh_memcpy(host.dataPtr(), uniform[mfi].dataPtr(), host.nBytes());
+        auto const& a = host.const_array();
+
+        Vector<int> local_planes;
+        for (int k = bx.smallEnd(vdir); k <= bx.bigEnd(vdir); ++k) {
+            if (plane_out[k - k0] >= 0) {
+                local_planes.push_back(k);
+            }
+        }
+        const int nlocal = static_cast<int>(local_planes.size());
+
+        // every plane goes to its own part of spec, so the planes can be
+        // done in parallel
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel
+#endif
+        {
+            RealFFT::Buffers buffers(fft);
+            Real* field = buffers.in();
+
+#ifdef AMREX_USE_OMP
+#pragma omp for schedule(dynamic)
+#endif
+            for (int p = 0; p < nlocal; ++p) {
+                const int kp = local_planes[p];
+                Real* s = &spec[static_cast<std::size_t>(plane_out[kp - k0]) * nq * nshells];
+
+                for (int n = 0; n <= temp_n; ++n) {
+
+                    // gather the plane
+
+                    Real mean{0.0_rt};
+                    IntVect iv = bx.smallEnd();
+                    iv[vdir] = kp;
+                    for (int j = 0; j < ny; ++j) {
+                        if (ndims == 3) {
+                            iv[1] = bx.smallEnd(1) + j;
+                        }
+                        for (int i = 0; i < nx; ++i) {
+                            iv[0] = bx.smallEnd(0) + i;
+                            Real v = a(iv, n);
+                            if (weighted && n < temp_n) {
+                                v *= std::sqrt(a(iv, dens_n));
+                            }
+                            field[static_cast<std::size_t>(j) * nx + i] = v;
+                            mean += v;
+                        }
+                    }
+
+                    // the temperature fluctuation about the plane average
+
+                    if (n == temp_n) {
+                        mean *= norm;
+                        for (std::size_t idx = 0; idx < npts; ++idx) {
+                            field[idx] -= mean;
+                        }
+                    }
+
+                    fft.forward(buffers);
+
+                    // the power, normalized so that it sums to the plane
+                    // average of the square of the field
+
+                    const auto* modes = buffers.out();
+                    for (std::size_t idx = 0; idx < nmodes; ++idx) {
+                        const Real power = multiplicity[idx] * std::norm(modes[idx]) * norm * norm;
+                        const int b = shell[idx];
+                        if (n == temp_n) {
+                            s[3 * nshells + b] += power;
+                        } else {
+                            s[b] += 0.5_rt * power;
+                            if (n == vdir) {
+                                s[2 * nshells + b] += 0.5_rt * power;
+                            } else {
+                                s[nshells + b] += 0.5_rt * power;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    ParallelDescriptor::ReduceRealSum(spec.data(), static_cast<int>(spec.size()),
+                                      ParallelDescriptor::IOProcessorNumber());
+
+    if (!ParallelDescriptor::IOProcessor()) {
+        return;
+    }
+
+    std::ofstream of(outfile);
+    if (!of.good()) {
+        amrex::FileOpenFailed(outfile);
+    }
+
+    of << "# time = " << std::setprecision(12) << pf.time() << "\n";
+    of << "# one block per height; the spectra in each block sum to the plane average\n";
+    of << "# " << std::setw(18) << "k";
+    for (auto const& name : qnames) {
+        of << " " << std::setw(20) << name;
+    }
+    of << "\n";
+
+    of << std::setprecision(12) << std::scientific;
+    for (int p = 0; p < static_cast<int>(planes.size()); ++p) {
+        const Real height = probLo[vdir] + (static_cast<Real>(planes[p]) + 0.5_rt) * dx[vdir];
+        of << "\n# height = " << height << "\n";
+        const Real* s = &spec[static_cast<std::size_t>(p) * nq * nshells];
+        for (int b = 0; b < nshells; ++b) {
+            of << "  " << std::setw(18) << static_cast<Real>(b) * dk;
+            for (int q = 0; q < nq; ++q) {
+                of << " " << std::setw(20) << s[q * nshells + b];
+            }
+            of << "\n";
+        }
+    }
+
+    amrex::Print() << "wrote " << outfile << std::endl;
+}
+
+void main_main()
+{
+
+    auto pltfiles = select_plotfiles(diag_rp::plotfile, diag_rp::catalog, diag_rp::query);
+
+    for (auto const& pltfile : pltfiles) {
+        amrex::Print() << "processing " << pltfile << std::endl;
+        spectra_plotfile(pltfile);
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    amrex::SetVerbose(0);
+    amrex::Initialize(argc, argv);
+
+    // initialize the runtime parameters
+
+    init_extern_parameters();
+
+    // initialize C++ Microphysics
+
+    eos_init(diag_rp::small_temp, diag_rp::small_dens);
+    network_init();
+
+    main_main();
+    amrex::Finalize();
+}
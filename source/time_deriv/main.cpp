@@ -0,0 +1,635 @@
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+
+#include <AMReX.H>
+#include <AMReX_Array.H>
+#include <AMReX_MultiFabUtil.H>
+#include <AMReX_ParallelDescriptor.H>
+#include <AMReX_Print.H>
+#include <AMReX_Vector.H>
+
+#include <extern_parameters.H>
+
+#include <network.H>
+#include <eos.H>
+
+#include <amrex_astro_util.H>
+#include <burn_rates.H>
+#include <diag_plotfile.H>
+#include <horizontal_average.H>
+#include <plotfile_catalog.H>
+#include <plotfile_meta.H>
+#include <plotfile_writer.H>
+
+using namespace amrex;
+
+///
+/// the components kept of each plotfile: rho, T and X (for the rates
+/// and the mass weighting), the fields to differentiate, the field that
+/// marks the boundary, and the network rates dX/dt
+///
+struct StateLayout
+{
+    Vector<std::string> fields;
+    std::string boundary_field;
+    bool rates{false};
+
+    int nfields () const { return static_cast<int>(fields.size()); }
+
+    static int rho () { return 0; }
+    static int temp () { return 1; }
+    static int spec () { return 2; }
+    int field (int f) const { return 2 + NumSpec + f; }
+    int boundary () const { return field(nfields()); }
+    int omegadot () const { return boundary() + (boundary_field.empty() ? 0 : 1); }
+    int ncomp () const { return omegadot() + (rates ? NumSpec : 0); }
+};
+
+///
+/// what is kept of one plotfile until the next one has been read
+///
+struct Snapshot
+{
+    std::string name;
+    Real time{0.0_rt};
+    Vector<Geometry> geom;
+    Vector<BoxArray> grids;
+    Vector<DistributionMapping> dmap;
+    Vector<int> level_steps;
+    Vector<IntVect> ref_ratio;
+    Vector<MultiFab> state;
+    Vector<Real> center;
+
+    // the height (or radius) of the boundary, NaN if there is none
+    Real boundary{std::numeric_limits<Real>::quiet_NaN()};
+};
+
+///
+/// the first height (or radius), going up (or out), where the profile
+/// crosses value, interpolating linearly between the bin centers
+///
+Real find_crossing (const Vector<Real>& prof, Real r0, Real dr, Real value)
+{
+    const int nbins = static_cast<int>(prof.size());
+    for (int b = 0; b < nbins-1; ++b) {
+        const Real d0 = prof[b] - value;
+        const Real d1 = prof[b+1] - value;
+        if (d0 == 0.0_rt) {
+            return r0 + (static_cast<Real>(b) + 0.5_rt) * dr;
+        }
+        if ((d0 < 0.0_rt) != (d1 < 0.0_rt)) {
+            const Real frac = d0 / (d0 - d1);
+            return r0 + (static_cast<Real>(b) + 0.5_rt + frac) * dr;
+        }
+    }
+    return std::numeric_limits<Real>::quiet_NaN();
+}
+
+///
+/// read the components of layout from a plotfile (the only time it is
+/// read), evaluate the network rates, and find the boundary
+///
+Snapshot read_snapshot (const std::string& pltfile, const StateLayout& layout)
+{
+    DiagPlotFile pf(pltfile, diag_rp::max_level, diag_rp::coarsen);
+
+    Snapshot s;
+    s.name = pltfile;
+    s.time = pf.time();
+
+    const int ndims = pf.spaceDim();
+    AMREX_ALWAYS_ASSERT(ndims <= AMREX_SPACEDIM);
+
+    const int nlevs = pf.finestLevel() + 1;
+    const int coord = pf.coordSys();
+    const int ncomp = layout.ncomp();
+
+    // the plotfile components, in the order of the layout
+
+    const Vector<std::string>& var_names_pf = pf.varNames();
+
+    Vector<std::string> read_names{var_names_pf[get_dens_index(var_names_pf)],
+                                   var_names_pf[get_temp_index(var_names_pf)]};
+    const int spec_comp = get_spec_index(var_names_pf);
+    for (int n = 0; n < NumSpec; ++n) {
+        read_names.push_back(var_names_pf[spec_comp+n]);
+    }
+    for (auto const& name : layout.fields) {
+        read_names.push_back(name);
+    }
+    if (!layout.boundary_field.empty()) {
+        read_names.push_back(layout.boundary_field);
+    }
+    for (auto const& name : read_names) {
+        if (std::find(var_names_pf.cbegin(), var_names_pf.cend(), name) == var_names_pf.cend()) {
+            amrex::Error("time_deriv: " + pltfile + " has no field " + name);
+        }
+    }
+
+    Array<int,AMREX_SPACEDIM> is_periodic{AMREX_D_DECL(0,0,0)};
+    for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+        is_periodic[idim] = 1;
+    }
+
+    for (int ilev = 0; ilev < nlevs; ++ilev) {
+        s.geom.emplace_back(pf.probDomain(ilev), RealBox(pf.probLo(),pf.probHi()),
+                            coord, is_periodic);
+        s.grids.push_back(pf.boxArray(ilev));
+        s.dmap.push_back(pf.DistributionMap(ilev));
+        s.level_steps.push_back(pf.levelStep(ilev));
+        if (ilev < pf.finestLevel()) {
+            s.ref_ratio.push_back(IntVect(pf.refRatio(ilev)));
+            for (int idim = ndims; idim < AMREX_SPACEDIM; ++idim) {
+                s.ref_ratio[ilev][idim] = 1;
+            }
+        }
+    }
+
+    s.state.resize(nlevs);
+
+    for (int ilev = 0; ilev < nlevs; ++ilev) {
+
+        MultiFab& state = s.state[ilev];
+        state.define(s.grids[ilev], s.dmap[ilev], ncomp, 0);
+
+        for (int c = 0; c < static_cast<int>(read_names.size()); ++c) {
+            MultiFab mf = pf.get(ilev, read_names[c]);
+            MultiFab::Copy(state, mf, 0, c, 1, 0);
+            pf.release(std::move(mf));
+        }
+
+        if (layout.rates) {
+            const int w_comp = layout.omegadot();
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel
+#endif
+            for (MFIter mfi(state, TilingIfNotGPU()); mfi.isValid(); ++mfi) {
+                const Box& bx = mfi.tilebox();
+                auto const& a = state.array(mfi);
+
+                amrex::ParallelFor(bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+                {
+                    Real X[NumSpec];
+                    Real dXdt[NumSpec];
+                    for (int n = 0; n < NumSpec; ++n) {
+                        X[n] = a(i,j,k,StateLayout::spec()+n);
+                    }
+                    burn_rates(a(i,j,k,StateLayout::rho()), a(i,j,k,StateLayout::temp()), X, dXdt);
+                    for (int n = 0; n < NumSpec; ++n) {
+                        a(i,j,k,w_comp+n) = dXdt[n];
+                    }
+                });
+            }
+        }
+    }
+
+    Gpu::streamSynchronize();
+
+    auto const probLo = pf.probLo();
+    auto const probHi = pf.probHi();
+
+    s.center.resize(AMREX_SPACEDIM, 0.0_rt);
+    for (int idim = 0; idim < ndims; ++idim) {
+        s.center[idim] = 0.5_rt * (probLo[idim] + probHi[idim]);
+    }
+    if (coord == 1) {
+        // axisymmetric -- the center is on the axis
+        s.center[0] = probLo[0];
+    }
+
+    // the boundary, from the horizontal (or shell) averages of the
+    // data we already have.  This is deliberately not the
+    // Schwarzschild/Ledoux boundary of convective_grad's
+    // find_boundaries(): that needs del, del_ad and del_ledoux (seven
+    // EOS calls per zone and a ghost cell fill), and it gives a
+    // position per column or ray, not one number whose velocity we can
+    // take.  The composition front is where the mixing has reached,
+    // which is what moves between dumps.
+
+    if (!layout.boundary_field.empty()) {
+        const int b_comp = layout.boundary();
+        HorizontalAverage averages(pf, GetVecOfConstPtrs(s.state), 1, diag_rp::spherical, s.center,
+                                   [=] (const Array4<const Real>& fab, int i, int j, int k,
+                                        const Array<Real, AMREX_SPACEDIM>& /*p*/, Real* q)
+                                   {
+                                       q[0] = fab(i,j,k,b_comp);
+                                   });
+        auto const table = averages.table();
+        s.boundary = find_crossing(averages.mean(0), table.r0, table.dr, diag_rp::boundary_value);
+    }
+
+    return s;
+}
+
+///
+/// the time derivatives between two consecutive plotfiles, on the grids
+/// of the later one.  Levels with the same grids are done box by box
+/// straight from the two states; otherwise the earlier state is copied
+/// onto the later grids first, and the zones it doesn't cover are
+/// marked as not valid.
+///
+void time_deriv_pair (const Snapshot& s0, const Snapshot& s1, const StateLayout& layout,
+                      PlotfileWriter& writer, std::ofstream& of)
+{
+    const Real dt = s1.time - s0.time;
+    if (!(dt > 0.0_rt)) {
+        amrex::Error("time_deriv: " + s1.name + " is not later than " + s0.name +
+                     " -- the plotfiles have to be in order of time");
+    }
+
+    amrex::Print() << s0.name << " -> " << s1.name << ", dt = " << dt << std::endl;
+
+    const int nlevs = static_cast<int>(s1.state.size());
+    const int nlevs0 = static_cast<int>(s0.state.size());
+    const int ncomp = layout.ncomp();
+    const int nf = layout.nfields();
+    const bool rates = layout.rates;
+
+    // d(field)/dt for each field, then for each species dX/dt, the
+    // time-centered network rate, and the rest (transport), and whether
+    // both states were there
+
+    Vector<std::string> gvarnames;
+    for (auto const& name : layout.fields) {
+        gvarnames.push_back("d" + name + "/dt");
+    }
+    if (rates) {
+        for (int n = 0; n < NumSpec; ++n) {
+            gvarnames.push_back("dX(" + short_spec_names_cxx[n] + ")/dt");
+        }
+        for (int n = 0; n < NumSpec; ++n) {
+            gvarnames.push_back("omegadot(" + short_spec_names_cxx[n] + ")");
+        }
+        for (int n = 0; n < NumSpec; ++n) {
+            gvarnames.push_back("transport(" + short_spec_names_cxx[n] + ")");
+        }
+    }
+    gvarnames.emplace_back("valid");
+    const int ngv = static_cast<int>(gvarnames.size());
+    const int dXdt_comp = nf;
+    const int w_comp = nf + NumSpec;
+    const int tr_comp = nf + 2 * NumSpec;
+    const int valid_comp = ngv - 1;
+
+    // the mass-weighted integrals over the valid zones not covered by a
+    // finer level: int rho dX/dt dV, int rho omegadot dV and
+    // int rho |transport| dV for each species, and the largest
+    // |d(field)/dt|
+
+    constexpr int nsums_spec = 3;
+    Vector<Real> sums(static_cast<std::size_t>(nsums_spec) * NumSpec, 0.0_rt);
+    Vector<Real> maxes(nf, 0.0_rt);
+    Vector<Long> counts{0, 0};
+
+    auto const probLo = s1.geom[0].ProbLoArray();
+    const int coord = s1.geom[0].Coord();
+
+    int nstreamed{0};
+    Vector<MultiFab> gmf(nlevs);
+
+    for (int ilev = 0; ilev < nlevs; ++ilev) {
+
+        const MultiFab& new_mf = s1.state[ilev];
+
+        // the earlier state on the grids of this one
+
+        iMultiFab present(s1.grids[ilev], s1.dmap[ilev], 1, 0);
+        MultiFab old_copy;
+        const MultiFab* old_mf = &old_copy;
+
+        if (ilev < nlevs0 && s0.grids[ilev] == s1.grids[ilev] && s0.dmap[ilev] == s1.dmap[ilev]) {
+            old_mf = &s0.state[ilev];
+            present.setVal(1);
+            ++nstreamed;
+        } else {
+            old_copy.define(s1.grids[ilev], s1.dmap[ilev], ncomp, 0);
+            old_copy.setVal(0.0_rt);
+            present.setVal(0);
+            if (ilev < nlevs0) {
+                if (s0.geom[ilev].Domain() != s1.geom[ilev].Domain()) {
+                    amrex::Error("time_deriv: the domains of level " + std::to_string(ilev) +
+                                 " of " + s0.name + " and " + s1.name + " differ");
+                }
+                old_copy.ParallelCopy(s0.state[ilev], 0, 0, ncomp);
+                iMultiFab ones(s0.grids[ilev], s0.dmap[ilev], 1, 0);
+                ones.setVal(1);
+                present.ParallelCopy(ones, 0, 0, 1);
+            }
+        }
+
+        gmf[ilev].define(s1.grids[ilev], s1.dmap[ilev], ngv, 0);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel
+#endif
+        for (MFIter mfi(gmf[ilev], TilingIfNotGPU()); mfi.isValid(); ++mfi) {
+            const Box& bx = mfi.tilebox();
+            auto const& ga = gmf[ilev].array(mfi);
+            auto const& a0 = old_mf->const_array(mfi);
+            auto const& a1 = new_mf.const_array(mfi);
+            auto const& pr = present.const_array(mfi);
+
+            const int f_comp = layout.field(0);
+            const int o_comp = layout.omegadot();
+
+            amrex::ParallelFor(bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+            {
+                if (pr(i,j,k) == 0) {
+                    for (int c = 0; c < ngv; ++c) {
+                        ga(i,j,k,c) = 0.0_rt;
+                    }
+                    return;
+                }
+
+                for (int f = 0; f < nf; ++f) {
+                    ga(i,j,k,f) = (a1(i,j,k,f_comp+f) - a0(i,j,k,f_comp+f)) / dt;
+                }
+                if (rates) {
+                    for (int n = 0; n < NumSpec; ++n) {
+                        const Real dXdt = (a1(i,j,k,StateLayout::spec()+n) - a0(i,j,k,StateLayout::spec()+n)) / dt;
+                        const Real w = 0.5_rt * (a0(i,j,k,o_comp+n) + a1(i,j,k,o_comp+n));
+                        ga(i,j,k,dXdt_comp+n) = dXdt;
+                        ga(i,j,k,w_comp+n) = w;
+                        ga(i,j,k,tr_comp+n) = dXdt - w;
+                    }
+                }
+                ga(i,j,k,valid_comp) = 1.0_rt;
+            });
+        }
+
+        Gpu::streamSynchronize();
+
+        // the integrals, over the zones not covered by a finer level
+
+        iMultiFab mask(s1.grids[ilev], s1.dmap[ilev], 1, 0);
+        if (ilev < nlevs-1) {
+            mask = makeFineMask(s1.grids[ilev], s1.dmap[ilev], s1.grids[ilev+1], s1.ref_ratio[ilev]);
+        } else {
+            mask.setVal(0);
+        }
+
+        auto const cell = s1.geom[ilev].CellSizeArray();
+        const Array<Real, AMREX_SPACEDIM> dx{AMREX_D_DECL(cell[0], cell[1], cell[2])};
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel
+#endif
+        {
+            Vector<Real> local_sums(sums.size(), 0.0_rt);
+            Vector<Real> local_maxes(nf, 0.0_rt);
+            Vector<Long> local_counts{0, 0};
+
+            for (MFIter mfi(gmf[ilev], TilingIfNotGPU()); mfi.isValid(); ++mfi) {
+                const Box& bx = mfi.tilebox();
+                auto const& ga = gmf[ilev].const_array(mfi);
+                auto const& a0 = old_mf->const_array(mfi);
+                auto const& a1 = new_mf.const_array(mfi);
+                auto const& m = mask.const_array(mfi);
+                const auto lo = amrex::lbound(bx);
+                const auto hi = amrex::ubound(bx);
+
+                for (int k = lo.z; k <= hi.z; ++k) {
+                    for (int j = lo.y; j <= hi.y; ++j) {
+                        for (int i = lo.x; i <= hi.x; ++i) {
+                            if (m(i,j,k) == 1) {
+                                continue;
+                            }
+                            if (ga(i,j,k,valid_comp) == 0.0_rt) {
+                                local_counts[1] += 1;
+                                continue;
+                            }
+                            local_counts[0] += 1;
+
+                            for (int f = 0; f < nf; ++f) {
+                                local_maxes[f] = amrex::max(local_maxes[f], std::abs(ga(i,j,k,f)));
+                            }
+
+                            if (!rates) {
+                                continue;
+                            }
+
+                            Array<Real, AMREX_SPACEDIM> p = {AMREX_D_DECL(probLo[0] + (static_cast<Real>(i) + 0.5_rt) * dx[0],
+                                                                          probLo[1] + (static_cast<Real>(j) + 0.5_rt) * dx[1],
+                                                                          probLo[2] + (static_cast<Real>(k) + 0.5_rt) * dx[2])};
+
+                            const Real vol = get_coord_info(p, s1.center, dx, coord, coord == 1).second;
+                            const Real rho = 0.5_rt * (a0(i,j,k,StateLayout::rho()) + a1(i,j,k,StateLayout::rho()));
+
+                            for (int n = 0; n < NumSpec; ++n) {
+                                local_sums[nsums_spec*n] += rho * ga(i,j,k,dXdt_comp+n) * vol;
+                                local_sums[nsums_spec*n+1] += rho * ga(i,j,k,w_comp+n) * vol;
+                                local_sums[nsums_spec*n+2] += rho * std::abs(ga(i,j,k,tr_comp+n)) * vol;
+                            }
+                        }
+                    }
+                }
+            }
+
+#ifdef AMREX_USE_OMP
+#pragma omp critical (time_deriv_reduce)
+#endif
+            {
+                for (std::size_t n = 0; n < sums.size(); ++n) {
+                    sums[n] += local_sums[n];
+                }
+                for (int f = 0; f < nf; ++f) {
+                    maxes[f] = amrex::max(maxes[f], local_maxes[f]);
+                }
+                counts[0] += local_counts[0];
+                counts[1] += local_counts[1];
+            }
+        }
+    }
+
+    ParallelDescriptor::ReduceRealSum(sums.data(), static_cast<int>(sums.size()));
+    ParallelDescriptor::ReduceRealMax(maxes.data(), nf);
+    ParallelDescriptor::ReduceLongSum(counts.data(), static_cast<int>(counts.size()));
+
+    // fill the covered zones from the finer levels
+
+    for (int ilev = nlevs-1; ilev > 0; --ilev) {
+        amrex::average_down(gmf[ilev], gmf[ilev-1], s1.geom[ilev], s1.geom[ilev-1],
+                            0, ngv, s1.ref_ratio[ilev-1]);
+    }
+
+    // the derivatives are centered between the two plotfiles
+
+    const Real time = 0.5_rt * (s0.time + s1.time);
+
+    std::string outfile = "time_deriv." +
+        std::filesystem::path(s1.name).filename().string();
+
+    writer.setAugmentTarget(s1.name, "time_deriv");
+    writer.begin(outfile, s1.grids, gvarnames, s1.geom, time, s1.level_steps, s1.ref_ratio);
+    for (int ilev = 0; ilev < nlevs; ++ilev) {
+        writer.write_level(ilev, std::move(gmf[ilev]));
+    }
+
+    amrex::Print() << "  " << nstreamed << " of " << nlevs << " levels on the same grids";
+    if (counts[1] > 0) {
+        amrex::Print() << ", " << counts[1] << " zones without the earlier state";
+    }
+    amrex::Print() << std::endl;
+
+    for (int f = 0; f < nf; ++f) {
+        amrex::Print() << "  max |d" << layout.fields[f] << "/dt| = " << maxes[f] << std::endl;
+    }
+
+    if (rates) {
+        amrex::Print() << "  " << std::setw(12) << std::left << "species" << std::right
+                       << std::setw(16) << "dM/dt" << std::setw(16) << "int rho wdot"
+                       << std::setw(16) << "int rho |tr|" << std::endl;
+        for (int n = 0; n < NumSpec; ++n) {
+            amrex::Print() << "  " << std::setw(12) << std::left << short_spec_names_cxx[n] << std::right
+                           << std::setprecision(6) << std::scientific
+                           << std::setw(16) << sums[nsums_spec*n]
+                           << std::setw(16) << sums[nsums_spec*n+1]
+                           << std::setw(16) << sums[nsums_spec*n+2] << std::endl;
+        }
+    }
+
+    Real velocity = std::numeric_limits<Real>::quiet_NaN();
+    if (!layout.boundary_field.empty()) {
+        velocity = (s1.boundary - s0.boundary) / dt;
+        amrex::Print() << "  boundary of " << layout.boundary_field << " = " << diag_rp::boundary_value
+                       << ": " << s0.boundary << " -> " << s1.boundary
+                       << ", velocity = " << velocity << std::endl;
+    }
+
+    if (ParallelDescriptor::IOProcessor()) {
+        of << "  " << std::setw(22) << s0.name << std::setw(22) << s1.name
+           << std::setprecision(12) << std::setw(22) << time << std::setw(22) << dt;
+        if (!layout.boundary_field.empty()) {
+            of << std::setw(22) << s1.boundary << std::setw(22) << velocity;
+        }
+        for (int f = 0; f < nf; ++f) {
+            of << std::setw(22) << maxes[f];
+        }
+        if (rates) {
+            for (auto s : sums) {
+                of << std::setw(22) << s;
+            }
+        }
+        of << std::endl;
+    }
+}
+
+void main_main()
+{
+
+    // two or more plotfiles, in order of time
+
+    Vector<std::string> pltfiles;
+    if (diag_rp::catalog.empty()) {
+        std::istringstream iss(diag_rp::plotfile);
+        std::string name;
+        while (iss >> name) {
+            if (name.back() == '/') {
+                name.pop_back();
+            }
+            pltfiles.push_back(name);
+        }
+    } else {
+        pltfiles = select_plotfiles(diag_rp::plotfile, diag_rp::catalog, diag_rp::query);
+    }
+    if (pltfiles.size() < 2) {
+        amrex::Error("time_deriv: needs at least two plotfiles, "
+                     "e.g. diag.plotfile=\"plt00100 plt00200\" or diag.catalog and diag.query");
+    }
+
+    // the fields to differentiate: the temperature unless given
+
+    StateLayout layout;
+    {
+        std::istringstream iss(diag_rp::fields);
+        std::string name;
+        while (iss >> name) {
+            layout.fields.push_back(name);
+        }
+    }
+    if (layout.fields.empty()) {
+        const auto varnames = read_plotfile_header(pltfiles[0]).varnames;
+        layout.fields.push_back(varnames[get_temp_index(varnames)]);
+    }
+    layout.boundary_field = diag_rp::boundary_field;
+    layout.rates = diag_rp::compare_rates;
+
+    // one line per pair of plotfiles
+
+    std::ofstream of;
+    if (ParallelDescriptor::IOProcessor()) {
+        of.open(diag_rp::outfile);
+        if (!of.is_open()) {
+            amrex::Error("time_deriv: unable to open " + diag_rp::outfile);
+        }
+        of << "# " << std::setw(20) << "plotfile 0" << std::setw(22) << "plotfile 1"
+           << std::setw(22) << "time" << std::setw(22) << "dt";
+        if (!layout.boundary_field.empty()) {
+            of << std::setw(22) << "boundary" << std::setw(22) << "velocity";
+        }
+        for (auto const& name : layout.fields) {
+            of << std::setw(22) << "max|d" + name + "/dt|";
+        }
+        if (layout.rates) {
+            for (int n = 0; n < NumSpec; ++n) {
+                const std::string& spec = short_spec_names_cxx[n];
+                of << std::setw(22) << "dM(" + spec + ")/dt"
+                   << std::setw(22) << "int_rho_wdot(" + spec + ")"
+                   << std::setw(22) << "int_rho_|tr|(" + spec + ")";
+            }
+        }
+        of << std::endl;
+    }
+
+    // one writer is shared by all of the pairs, so the output of one
+    // goes to disk while the next plotfile is read
+
+    PlotfileWriter writer(diag_rp::async_output);
+    writer.setFormat(diag_rp::output_format, diag_rp::float_fields, diag_rp::hdf5_compression);
+
+    // each plotfile is read once, and kept until the pair it starts is
+    // done
+
+    amrex::Print() << "reading " << pltfiles[0] << std::endl;
+    Snapshot prev = read_snapshot(pltfiles[0], layout);
+
+    for (std::size_t n = 1; n < pltfiles.size(); ++n) {
+        amrex::Print() << "reading " << pltfiles[n] << std::endl;
+        Snapshot next = read_snapshot(pltfiles[n], layout);
+
+        time_deriv_pair(prev, next, layout, writer, of);
+
+        prev = std::move(next);
+    }
+
+    writer.wait();
+
+    amrex::Print() << "wrote " << diag_rp::outfile << std::endl;
+}
+
+int main (int argc, char* argv[])
+{
+    amrex::SetVerbose(0);
+    amrex::Initialize(argc, argv, true, MPI_COMM_WORLD, enable_async_output);
+
+    // initialize the runtime parameters
+
+    init_extern_parameters();
+
+    // initialize C++ Microphysics
+
+    eos_init(diag_rp::small_temp, diag_rp::small_dens);
+    network_init();
+
+    main_main();
+
+    amrex::Finalize();
+}